@@ -0,0 +1,37 @@
+#ifndef APP_H
+#define APP_H
+
+/*
+ * Optional layer 3 application around the simulator, on threads of its
+ * own.  A producer numbers packets into one injection ring per entity;
+ * the simulator takes its layer 3 packets from there and pushes every
+ * delivery, with its simulated time, into a ring drained by a consumer
+ * that checks each direction arrives complete and in order.
+ */
+
+#define APPRING 4096 /* slots in each ring */
+
+struct appstats
+{
+    long delivered;      /* packets the consumer took */
+    long inorder;        /* of which the next one of their direction */
+    long duplicates;     /* an earlier packet again */
+    long missing;        /* packets skipped over */
+    long injectstalls;   /* times the simulator found no packet waiting */
+    long deliverstalls;  /* times it found the delivery ring full */
+    double wall;         /* seconds from app_start() to the last delivery */
+    float simfirst;      /* simulated time of the first delivery */
+    float simlast;       /* and of the last */
+};
+
+/* 0 if the rings or threads could not be set up */
+int app_start(void);
+
+/* called by the simulator only */
+void app_take(int entity, char data[4]);
+void app_deliver(int entity, float simtime, const char data[4]);
+
+/* let the consumer drain the deliveries and stop both threads */
+void app_stop(struct appstats *stats);
+
+#endif
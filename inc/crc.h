@@ -0,0 +1,30 @@
+#ifndef CRC_H
+#define CRC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* bytes of a frame the receiver runs the CRC over: payload, seqnum, */
+/* acknum, type and checksum, in the order decode() uses             */
+#define CRCMSGLEN 8
+
+/* CRC remainder of len bytes, one bit at a time, MSB first */
+uint8_t crc8_bitwise(const uint8_t *input, int len, uint8_t generator);
+
+/* remainders of n frames of CRCMSGLEN bytes each, laid out back to */
+/* back in msgs; the same values crc8_bitwise() gives for each one  */
+void crc8_batch(const uint8_t *msgs, int n, uint8_t generator, uint8_t *rem);
+
+/* the same, forcing one implementation; for benchmarks and tests */
+#define CRC_SCALAR 0
+#define CRC_SSSE3 1
+#define CRC_AVX2 2
+#define CRC_AVX512 3
+int crc8_batch_best(void);
+void crc8_batch_with(int impl, const uint8_t *msgs, int n, uint8_t generator,
+                     uint8_t *rem);
+
+/* CRC-32 (IEEE 802.3) of len bytes, continuing from crc; start with 0 */
+uint32_t crc32_update(uint32_t crc, const uint8_t *buf, size_t len);
+
+#endif
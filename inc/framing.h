@@ -0,0 +1,55 @@
+#ifndef FRAMING_H
+#define FRAMING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Byte-oriented framing in the style of HDLC/PPP (RFC 1662): every frame
+ * goes onto the stream between FLAG bytes, and a FLAG or ESCAPE inside it
+ * is sent as ESCAPE followed by the byte XOR 0x20.  A receiver that lost
+ * its place, because a flag or escape was damaged, finds it again at the
+ * next flag; ESCAPE FLAG aborts the frame in progress.
+ */
+
+#define FLAG 0x7e
+#define ESCAPE 0x7d
+#define ESCXOR 0x20
+
+/* room framing_stuff() needs for n bytes: all escaped, plus two flags */
+#define STUFFMAX(n) (2 * (n) + 2)
+
+/* n bytes as one frame, flags included; returns the bytes written */
+size_t framing_stuff(const uint8_t *in, size_t n, uint8_t *out);
+
+struct deframer
+{
+    uint8_t *buf;     /* the frame being collected */
+    size_t size;      /* room in buf, longer frames are dropped */
+    size_t len;
+    int hunting;      /* no flag seen yet, or the frame overran buf */
+    int escaped;      /* the previous byte was ESCAPE */
+    long frames;      /* frames passed on */
+    long aborts;      /* ended by ESCAPE FLAG */
+    long overruns;    /* longer than size */
+    long discarded;   /* bytes dropped while hunting for a flag */
+};
+
+/* 0 if out of memory */
+int deframer_init(struct deframer *d, size_t maxframe);
+void deframer_free(struct deframer *d);
+
+/* take n more bytes of the stream and call frame() with every frame a */
+/* flag closes, its escapes removed; returns the number of frames      */
+int deframe(struct deframer *d, const uint8_t *in, size_t n,
+            void (*frame)(const uint8_t *buf, size_t len, void *arg), void *arg);
+
+/* the flag and escape scan both directions use, by instruction set; */
+/* the best the CPU has is chosen unless framing_use() says otherwise */
+#define FRAMING_SCALAR 0
+#define FRAMING_SSE2 1
+#define FRAMING_AVX2 2
+int framing_best(void);
+void framing_use(int impl);
+
+#endif
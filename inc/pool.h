@@ -0,0 +1,18 @@
+#ifndef POOL_H
+#define POOL_H
+
+/*
+ * Work-stealing pool for independent jobs.  Jobs 0..njobs-1 are dealt
+ * round robin onto one deque per worker; a worker takes from the back of
+ * its own deque and, once that is empty, steals from the front of the
+ * others, so long jobs on one worker do not leave the rest idle.
+ */
+
+/* online cores, at least 1 */
+int pool_ncpus(void);
+
+/* run job(i, arg) for every i on nthreads workers (0 for all cores) */
+void pool_run(int njobs, int nthreads, void (*job)(int index, void *arg),
+              void *arg);
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef PROF_H
+#define PROF_H
+
+#include <stdint.h>
+
+/*
+ * Optional instrumentation of the simulator.  Build with
+ *   make clean && make PROFILE=1   cycles per slot (rdtsc)
+ *   make clean && make PROFILE=2   also hardware counters (perf_event_open)
+ * With PROFILE 0, the default, every macro below expands to nothing.
+ */
+#ifndef PROFILE
+#define PROFILE 0
+#endif
+
+/* what is timed: event dispatch by type first, in event type order */
+enum profslot
+{
+    PROF_TIMER_INTERRUPT,
+    PROF_FROM_LAYER3,
+    PROF_FROM_LAYER1,
+    PROF_LINK_SAMPLE,
+    PROF_FLOW_TIMER,
+    PROF_FLOW_TX,
+    PROF_MAC_ARRIVAL,
+    PROF_NEVENTS,           /* dispatch slots for event types below this */
+    PROF_ENCODE = PROF_NEVENTS,
+    PROF_DECODE,
+    PROF_INSERTEVENT,
+    PROF_STARTTIMER,
+    PROF_STOPTIMER,
+    PROF_TOLAYER1,
+    PROF_PRINTF,
+    PROF_NSLOTS
+};
+
+#define PROF_NHW 3 /* instructions, cache misses, branch misses */
+
+struct profmark
+{
+    uint64_t tsc;
+    uint64_t hw[PROF_NHW];
+};
+
+void prof_start(void);
+void prof_report(void);
+void prof_begin(struct profmark *m);
+void prof_end(struct profmark *m, int slot);
+int prof_printf(const char *fmt, ...);
+
+#if PROFILE
+#define PROF_BEGIN(name) struct profmark prof_##name; prof_begin(&prof_##name)
+#define PROF_END(name, slot) prof_end(&prof_##name, (slot))
+#else
+#define PROF_BEGIN(name)
+#define PROF_END(name, slot)
+#endif
+
+#endif
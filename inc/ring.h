@@ -0,0 +1,23 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stddef.h>
+
+/*
+ * Lock-free ring of fixed-size records for exactly one producer thread
+ * and one consumer thread.  Each side owns its index and keeps a cached
+ * copy of the other's, so it only touches the other side's cache line
+ * when the ring looks full (producer) or empty (consumer).
+ */
+
+struct ring;
+
+/* nslots is rounded up to a power of two; NULL if out of memory */
+struct ring *ring_create(size_t nslots, size_t size);
+void ring_free(struct ring *r);
+
+/* copy a record in or out; 0 if the ring is full or empty */
+int ring_push(struct ring *r, const void *rec);
+int ring_pop(struct ring *r, void *rec);
+
+#endif
@@ -0,0 +1,176 @@
+#define _POSIX_C_SOURCE 200809L
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "ring.h"
+#include "app.h"
+
+/*
+ * Packets are numbered per direction in their first three bytes; the
+ * fourth stays 0 so a payload still reads as a string.  A side that finds
+ * its ring full or empty yields instead of spinning, since the machine
+ * may have fewer cores than the pipeline has stages.  The simulator only
+ * writes the two stall counters of stats and the consumer the rest, and
+ * app_stop() reads them after joining both threads.
+ */
+
+#define SEQMASK 0xffffff
+
+struct delivery
+{
+    float simtime;
+    int entity;
+    char data[4];
+};
+
+static struct ring *inject[2], *deliver;
+static pthread_t producer, consumer;
+static int stopping;
+static struct appstats stats;
+static struct timespec t0, tlast;
+
+static void seq_put(char data[4], unsigned long seq)
+{
+    data[0] = seq;
+    data[1] = seq >> 8;
+    data[2] = seq >> 16;
+    data[3] = 0;
+}
+
+static unsigned long seq_get(const char data[4])
+{
+    return (unsigned long)(unsigned char)data[0] |
+           (unsigned long)(unsigned char)data[1] << 8 |
+           (unsigned long)(unsigned char)data[2] << 16;
+}
+
+static void *produce(void *arg)
+{
+    unsigned long seq[2] = { 0, 0 };
+    char data[4];
+    int e, idle;
+
+    (void)arg;
+    while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE))
+    {
+        idle = 1;
+        for (e = 0; e < 2; e++)
+        {
+            seq_put(data, seq[e]);
+            if (ring_push(inject[e], data))
+            {
+                seq[e] = (seq[e] + 1) & SEQMASK;
+                idle = 0;
+            }
+        }
+        if (idle)
+            sched_yield();
+    }
+    return NULL;
+}
+
+static void *consume(void *arg)
+{
+    unsigned long expect[2] = { 0, 0 }, ahead;
+    struct delivery d;
+    int from;
+
+    (void)arg;
+    for (;;)
+    {
+        if (!ring_pop(deliver, &d))
+        {
+            if (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE))
+            {
+                sched_yield();
+                continue;
+            }
+            if (!ring_pop(deliver, &d)) /* stopped and drained */
+                break;
+        }
+
+        from = 1 - d.entity; /* delivered at B was sent by A */
+        ahead = (seq_get(d.data) - expect[from]) & SEQMASK;
+        if (ahead == 0)
+            stats.inorder++;
+        else if (ahead > SEQMASK / 2) /* behind what was expected */
+            stats.duplicates++;
+        else
+            stats.missing += ahead;
+        if (ahead <= SEQMASK / 2)
+            expect[from] = (seq_get(d.data) + 1) & SEQMASK;
+
+        if (stats.delivered++ == 0)
+            stats.simfirst = d.simtime;
+        stats.simlast = d.simtime;
+        clock_gettime(CLOCK_MONOTONIC, &tlast);
+    }
+    return NULL;
+}
+
+int app_start(void)
+{
+    memset(&stats, 0, sizeof(stats));
+    stopping = 0;
+    inject[0] = ring_create(APPRING, 4);
+    inject[1] = ring_create(APPRING, 4);
+    deliver = ring_create(APPRING, sizeof(struct delivery));
+    if (inject[0] == NULL || inject[1] == NULL || deliver == NULL)
+        goto fail;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    tlast = t0;
+    if (pthread_create(&producer, NULL, produce, NULL) != 0)
+        goto fail;
+    if (pthread_create(&consumer, NULL, consume, NULL) != 0)
+    {
+        __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+        pthread_join(producer, NULL);
+        goto fail;
+    }
+    return 1;
+
+fail:
+    ring_free(inject[0]);
+    ring_free(inject[1]);
+    ring_free(deliver);
+    return 0;
+}
+
+void app_take(int entity, char data[4])
+{
+    while (!ring_pop(inject[entity], data))
+    {
+        stats.injectstalls++;
+        sched_yield();
+    }
+}
+
+void app_deliver(int entity, float simtime, const char data[4])
+{
+    struct delivery d;
+
+    d.simtime = simtime;
+    d.entity = entity;
+    memcpy(d.data, data, 4);
+    while (!ring_push(deliver, &d))
+    {
+        stats.deliverstalls++;
+        sched_yield();
+    }
+}
+
+void app_stop(struct appstats *out)
+{
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    pthread_join(producer, NULL);
+    pthread_join(consumer, NULL);
+
+    stats.wall = (tlast.tv_sec - t0.tv_sec) + (tlast.tv_nsec - t0.tv_nsec) / 1e9;
+    *out = stats;
+    ring_free(inject[0]);
+    ring_free(inject[1]);
+    ring_free(deliver);
+}
@@ -0,0 +1,132 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "crc.h"
+#include "framing.h"
+
+/*
+ * Frames verified per second by the batch CRC, against the bit-at-a-time
+ * loop decode() runs.  Every implementation must agree with it exactly.
+ * Then bytes per second through the framing's stuffer and deframer, which
+ * must give back every frame as it went in.
+ *
+ *   make bench && ./bench.out [frames] [generator]
+ */
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+#define BENCHFRAME 1500
+
+struct deframed
+{
+    const uint8_t *data; /* the frames that were stuffed, back to back */
+    long n, bad;
+};
+
+static void check_frame(const uint8_t *buf, size_t len, void *arg)
+{
+    struct deframed *f = arg;
+
+    if (len != BENCHFRAME || memcmp(buf, f->data + f->n * BENCHFRAME, len) != 0)
+        f->bad++;
+    f->n++;
+}
+
+static int bench_framing(int nframes)
+{
+    static const char *names[] = { "scalar", "SSE2", "AVX2" };
+    uint8_t *data, *wire;
+    size_t wirelen;
+    struct deframer d;
+    struct deframed f;
+    double t, secs;
+    int reps, i, impl;
+
+    data = malloc((size_t)nframes * BENCHFRAME);
+    wire = malloc((size_t)nframes * STUFFMAX(BENCHFRAME));
+    for (i = 0; i < nframes * BENCHFRAME; i++)
+        data[i] = rand();
+    deframer_init(&d, BENCHFRAME);
+
+    printf("%d frames of %d bytes through the framing\n", nframes, BENCHFRAME);
+    for (impl = FRAMING_SCALAR; impl <= framing_best(); impl++) {
+        framing_use(impl);
+        t = now();
+        for (reps = 0; reps == 0 || (secs = now() - t) < 0.5; reps++)
+            for (wirelen = 0, i = 0; i < nframes; i++)
+                wirelen += framing_stuff(data + (size_t)i * BENCHFRAME,
+                                         BENCHFRAME, wire + wirelen);
+        printf("  %-14s stuff   %8.3f GB/s\n", names[impl],
+               (double)nframes * BENCHFRAME * reps / secs / 1e9);
+
+        f.data = data;
+        t = now();
+        for (reps = 0; reps == 0 || (secs = now() - t) < 0.5; reps++) {
+            f.n = f.bad = 0;
+            deframe(&d, wire, wirelen, check_frame, &f);
+        }
+        if (f.n != nframes || f.bad != 0) {
+            printf("  %-14s MISMATCH\n", names[impl]);
+            return 1;
+        }
+        printf("  %-14s unstuff %8.3f GB/s\n", names[impl],
+               (double)wirelen * reps / secs / 1e9);
+    }
+    deframer_free(&d);
+    free(data);
+    free(wire);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static const char *names[] = { "scalar table", "SSSE3", "AVX2", "AVX-512" };
+    int n = argc > 1 ? atoi(argv[1]) : 1 << 20;
+    uint8_t generator = argc > 2 ? strtol(argv[2], NULL, 2) : 0x1d;
+    uint8_t *msgs, *ref, *rem;
+    double t, secs;
+    int reps, i, impl;
+
+    msgs = malloc((size_t)n * CRCMSGLEN);
+    ref = malloc(n);
+    rem = malloc(n);
+    srand(9999);
+    for (i = 0; i < n * CRCMSGLEN; i++)
+        msgs[i] = rand();
+    /* make some of them valid frames, as a receiver would mostly see */
+    for (i = 0; i < n; i += 2)
+        msgs[i * CRCMSGLEN + CRCMSGLEN - 1] = 0;
+    for (i = 0; i < n; i += 2)
+        msgs[i * CRCMSGLEN + CRCMSGLEN - 1] =
+            crc8_bitwise(msgs + i * CRCMSGLEN, CRCMSGLEN, generator);
+
+    printf("%d frames of %d bytes, generator 0x%02x\n", n, CRCMSGLEN, generator);
+
+    t = now();
+    for (i = 0; i < n; i++)
+        ref[i] = crc8_bitwise(msgs + i * CRCMSGLEN, CRCMSGLEN, generator);
+    secs = now() - t;
+    printf("  %-14s %12.0f frames/s\n", "bitwise", n / secs);
+
+    for (impl = CRC_SCALAR; impl <= crc8_batch_best(); impl++) {
+        memset(rem, 0xff, n);
+        crc8_batch_with(impl, msgs, n, generator, rem); /* warm up, check */
+        if (memcmp(rem, ref, n) != 0) {
+            printf("  %-14s MISMATCH\n", names[impl]);
+            return 1;
+        }
+        t = now();
+        for (reps = 0; (secs = now() - t) < 0.5; reps++)
+            crc8_batch_with(impl, msgs, n, generator, rem);
+        printf("  %-14s %12.0f frames/s\n", names[impl], (double)n * reps / secs);
+    }
+    return bench_framing(1 << 14);
+}
@@ -0,0 +1,269 @@
+#include <string.h>
+#include <immintrin.h>
+
+#include "crc.h"
+
+/*
+ * Batch CRC verification.
+ *
+ * With a zero initial register the CRC is linear over GF(2), so the
+ * remainder of a frame is the XOR of the remainders of each byte in its
+ * position: crc(m) = T0[m0] ^ T1[m1] ^ ... ^ T7[m7].  Each Ti is split by
+ * nibble, Ti[b] = Li[b & 15] ^ Hi[b >> 4], which makes every lookup a
+ * 16-entry table: exactly what pshufb does for 16 (SSSE3), 32 (AVX2) or
+ * 64 (AVX-512BW) frames at once.  The frames are transposed first so that
+ * one vector holds the same byte position of every frame.
+ */
+
+struct crctables
+{
+    uint8_t generator;
+    int ready;
+    uint8_t lo[CRCMSGLEN][16]; /* Ti for the low nibble of byte i */
+    uint8_t hi[CRCMSGLEN][16]; /* Ti for the high nibble of byte i */
+    uint8_t full[CRCMSGLEN][256];
+};
+
+static struct crctables tables;
+
+uint8_t crc8_bitwise(const uint8_t *input, int len, uint8_t generator)
+{
+    uint8_t crc = 0;
+
+    for (int i = 0; i < len; i++) {
+        /* Take one byte from input. XOR it with CRC register and put it in. */
+        crc ^= input[i];
+
+        for (int j = 0; j < 8; j++) {
+
+            /* If MSB of CRC is 1, LShift and XOR with generator.
+             * Otherwise, just do LShift.
+             *
+             * 0x80 == 0b10000000 */
+            if (crc & 0x80)
+                crc = (crc << 1 ) ^ generator;
+            else
+                crc <<= 1;
+        }
+    }
+    return crc;
+}
+
+static void crc_tables(uint8_t generator)
+{
+    uint8_t msg[CRCMSGLEN];
+
+    if (tables.ready && tables.generator == generator)
+        return;
+
+    for (int i = 0; i < CRCMSGLEN; i++) {
+        for (int b = 0; b < 256; b++) {
+            memset(msg, 0, sizeof(msg));
+            msg[i] = b;
+            tables.full[i][b] = crc8_bitwise(msg, CRCMSGLEN, generator);
+        }
+        for (int n = 0; n < 16; n++) {
+            tables.lo[i][n] = tables.full[i][n];
+            tables.hi[i][n] = tables.full[i][n << 4];
+        }
+    }
+    tables.generator = generator;
+    tables.ready = 1;
+}
+
+static void crc8_scalar(const uint8_t *msgs, int n, uint8_t *rem)
+{
+    for (int f = 0; f < n; f++, msgs += CRCMSGLEN) {
+        uint8_t crc = 0;
+        for (int i = 0; i < CRCMSGLEN; i++)
+            crc ^= tables.full[i][msgs[i]];
+        rem[f] = crc;
+    }
+}
+
+/* 16 frames of 8 bytes into 8 vectors: out[i] = byte i of frames 0..15; */
+/* always inlined so it is encoded for the caller's instruction set and   */
+/* the AVX paths do not pay for switching to legacy SSE and back          */
+__attribute__((target("ssse3"), always_inline))
+static inline void transpose16(const uint8_t *msgs, __m128i *out)
+{
+    /* pair up byte i of two frames into 16-bit word i */
+    const __m128i pair = _mm_setr_epi8(0, 8, 1, 9, 2, 10, 3, 11,
+                                       4, 12, 5, 13, 6, 14, 7, 15);
+    __m128i r[8], s[8], t[8];
+
+    for (int k = 0; k < 8; k++)
+        r[k] = _mm_shuffle_epi8(
+            _mm_loadu_si128((const __m128i *)(msgs + 16 * k)), pair);
+
+    /* then an 8x8 transpose of those 16-bit words */
+    for (int k = 0; k < 4; k++) {
+        s[2 * k] = _mm_unpacklo_epi16(r[2 * k], r[2 * k + 1]);
+        s[2 * k + 1] = _mm_unpackhi_epi16(r[2 * k], r[2 * k + 1]);
+    }
+    for (int k = 0; k < 2; k++) {
+        t[4 * k] = _mm_unpacklo_epi32(s[4 * k], s[4 * k + 2]);
+        t[4 * k + 1] = _mm_unpackhi_epi32(s[4 * k], s[4 * k + 2]);
+        t[4 * k + 2] = _mm_unpacklo_epi32(s[4 * k + 1], s[4 * k + 3]);
+        t[4 * k + 3] = _mm_unpackhi_epi32(s[4 * k + 1], s[4 * k + 3]);
+    }
+    for (int k = 0; k < 4; k++) {
+        out[2 * k] = _mm_unpacklo_epi64(t[k], t[k + 4]);
+        out[2 * k + 1] = _mm_unpackhi_epi64(t[k], t[k + 4]);
+    }
+}
+
+__attribute__((target("ssse3")))
+static void crc8_ssse3(const uint8_t *msgs, int n, uint8_t *rem)
+{
+    const __m128i nib = _mm_set1_epi8(0x0f);
+    __m128i lo[CRCMSGLEN], hi[CRCMSGLEN], v[CRCMSGLEN], crc;
+    int f;
+
+    for (int i = 0; i < CRCMSGLEN; i++) {
+        lo[i] = _mm_loadu_si128((const __m128i *)tables.lo[i]);
+        hi[i] = _mm_loadu_si128((const __m128i *)tables.hi[i]);
+    }
+    for (f = 0; f + 16 <= n; f += 16) {
+        transpose16(msgs + f * CRCMSGLEN, v);
+        crc = _mm_setzero_si128();
+        for (int i = 0; i < CRCMSGLEN; i++) {
+            crc = _mm_xor_si128(crc,
+                _mm_shuffle_epi8(lo[i], _mm_and_si128(v[i], nib)));
+            crc = _mm_xor_si128(crc,
+                _mm_shuffle_epi8(hi[i],
+                    _mm_and_si128(_mm_srli_epi16(v[i], 4), nib)));
+        }
+        _mm_storeu_si128((__m128i *)(rem + f), crc);
+    }
+    crc8_scalar(msgs + f * CRCMSGLEN, n - f, rem + f);
+}
+
+__attribute__((target("avx2")))
+static void crc8_avx2(const uint8_t *msgs, int n, uint8_t *rem)
+{
+    const __m256i nib = _mm256_set1_epi8(0x0f);
+    __m256i lo[CRCMSGLEN], hi[CRCMSGLEN], v, crc;
+    __m128i a[CRCMSGLEN], b[CRCMSGLEN];
+    int f;
+
+    for (int i = 0; i < CRCMSGLEN; i++) {
+        lo[i] = _mm256_broadcastsi128_si256(
+            _mm_loadu_si128((const __m128i *)tables.lo[i]));
+        hi[i] = _mm256_broadcastsi128_si256(
+            _mm_loadu_si128((const __m128i *)tables.hi[i]));
+    }
+    for (f = 0; f + 32 <= n; f += 32) {
+        transpose16(msgs + f * CRCMSGLEN, a);
+        transpose16(msgs + (f + 16) * CRCMSGLEN, b);
+        crc = _mm256_setzero_si256();
+        for (int i = 0; i < CRCMSGLEN; i++) {
+            v = _mm256_inserti128_si256(_mm256_castsi128_si256(a[i]), b[i], 1);
+            crc = _mm256_xor_si256(crc,
+                _mm256_shuffle_epi8(lo[i], _mm256_and_si256(v, nib)));
+            crc = _mm256_xor_si256(crc,
+                _mm256_shuffle_epi8(hi[i],
+                    _mm256_and_si256(_mm256_srli_epi16(v, 4), nib)));
+        }
+        _mm256_storeu_si256((__m256i *)(rem + f), crc);
+    }
+    crc8_ssse3(msgs + f * CRCMSGLEN, n - f, rem + f);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void crc8_avx512(const uint8_t *msgs, int n, uint8_t *rem)
+{
+    const __m512i nib = _mm512_set1_epi8(0x0f);
+    __m512i lo[CRCMSGLEN], hi[CRCMSGLEN], v, crc;
+    __m128i q[4][CRCMSGLEN];
+    int f;
+
+    for (int i = 0; i < CRCMSGLEN; i++) {
+        lo[i] = _mm512_broadcast_i32x4(
+            _mm_loadu_si128((const __m128i *)tables.lo[i]));
+        hi[i] = _mm512_broadcast_i32x4(
+            _mm_loadu_si128((const __m128i *)tables.hi[i]));
+    }
+    for (f = 0; f + 64 <= n; f += 64) {
+        for (int k = 0; k < 4; k++)
+            transpose16(msgs + (f + 16 * k) * CRCMSGLEN, q[k]);
+        crc = _mm512_setzero_si512();
+        for (int i = 0; i < CRCMSGLEN; i++) {
+            v = _mm512_castsi128_si512(q[0][i]);
+            v = _mm512_inserti32x4(v, q[1][i], 1);
+            v = _mm512_inserti32x4(v, q[2][i], 2);
+            v = _mm512_inserti32x4(v, q[3][i], 3);
+            crc = _mm512_xor_si512(crc,
+                _mm512_shuffle_epi8(lo[i], _mm512_and_si512(v, nib)));
+            crc = _mm512_xor_si512(crc,
+                _mm512_shuffle_epi8(hi[i],
+                    _mm512_and_si512(_mm512_srli_epi16(v, 4), nib)));
+        }
+        _mm512_storeu_si512((void *)(rem + f), crc);
+    }
+    crc8_avx2(msgs + f * CRCMSGLEN, n - f, rem + f);
+}
+
+int crc8_batch_best(void)
+{
+    static int best = -1;
+
+    if (best < 0) {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512bw"))
+            best = CRC_AVX512;
+        else if (__builtin_cpu_supports("avx2"))
+            best = CRC_AVX2;
+        else if (__builtin_cpu_supports("ssse3"))
+            best = CRC_SSSE3;
+        else
+            best = CRC_SCALAR;
+    }
+    return best;
+}
+
+void crc8_batch_with(int impl, const uint8_t *msgs, int n, uint8_t generator,
+                     uint8_t *rem)
+{
+    crc_tables(generator);
+    if (impl > crc8_batch_best())
+        impl = crc8_batch_best();
+
+    if (impl == CRC_AVX512)
+        crc8_avx512(msgs, n, rem);
+    else if (impl == CRC_AVX2)
+        crc8_avx2(msgs, n, rem);
+    else if (impl == CRC_SSSE3)
+        crc8_ssse3(msgs, n, rem);
+    else
+        crc8_scalar(msgs, n, rem);
+}
+
+void crc8_batch(const uint8_t *msgs, int n, uint8_t generator, uint8_t *rem)
+{
+    crc8_batch_with(crc8_batch_best(), msgs, n, generator, rem);
+}
+
+/*
+ * Whole-file checksum: the reflected CRC-32 of zlib and Ethernet, one
+ * table lookup per byte.
+ */
+
+static uint32_t crc32_table[256];
+
+uint32_t crc32_update(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    if (crc32_table[1] == 0) {
+        for (uint32_t b = 0; b < 256; b++) {
+            uint32_t c = b;
+            for (int j = 0; j < 8; j++)
+                c = (c & 1) ? (c >> 1) ^ 0xedb88320 : c >> 1;
+            crc32_table[b] = c;
+        }
+    }
+
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++)
+        crc = crc32_table[(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
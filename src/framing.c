@@ -0,0 +1,204 @@
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+
+#include "framing.h"
+
+/*
+ * Both directions spend their time looking for the next FLAG or ESCAPE:
+ * the stuffer to escape it, the deframer to act on it.  Everything in
+ * between is copied as a block.  The scan compares 16 (SSE2) or 32 (AVX2)
+ * bytes against both values at once and turns the result into a bit mask
+ * with movemask, so on data where the two are rare (2 bytes in 256 of
+ * random data) the cost per byte is a fraction of a compare.
+ */
+
+static size_t scan_scalar(const uint8_t *p, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        if (p[i] == FLAG || p[i] == ESCAPE)
+            break;
+    return i;
+}
+
+__attribute__((target("sse2")))
+static size_t scan_sse2(const uint8_t *p, size_t n)
+{
+    const __m128i flag = _mm_set1_epi8(FLAG);
+    const __m128i escape = _mm_set1_epi8(ESCAPE);
+    size_t i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        int m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, flag),
+                                               _mm_cmpeq_epi8(v, escape)));
+        if (m)
+            return i + __builtin_ctz(m);
+    }
+    return i + scan_scalar(p + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_avx2(const uint8_t *p, size_t n)
+{
+    const __m256i flag = _mm256_set1_epi8(FLAG);
+    const __m256i escape = _mm256_set1_epi8(ESCAPE);
+    size_t i;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+        unsigned m = _mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, flag),
+                            _mm256_cmpeq_epi8(v, escape)));
+        if (m)
+            return i + __builtin_ctz(m);
+    }
+    return i + scan_sse2(p + i, n - i);
+}
+
+static size_t (*scan)(const uint8_t *p, size_t n);
+
+int framing_best(void)
+{
+    static int best = -1;
+
+    if (best < 0) {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            best = FRAMING_AVX2;
+        else if (__builtin_cpu_supports("sse2"))
+            best = FRAMING_SSE2;
+        else
+            best = FRAMING_SCALAR;
+    }
+    return best;
+}
+
+void framing_use(int impl)
+{
+    if (impl > framing_best())
+        impl = framing_best();
+    if (impl == FRAMING_AVX2)
+        scan = scan_avx2;
+    else if (impl == FRAMING_SSE2)
+        scan = scan_sse2;
+    else
+        scan = scan_scalar;
+}
+
+size_t framing_stuff(const uint8_t *in, size_t n, uint8_t *out)
+{
+    uint8_t *o = out;
+    size_t k;
+
+    if (scan == NULL)
+        framing_use(framing_best());
+
+    *o++ = FLAG;
+    for (;;) {
+        k = scan(in, n);
+        memcpy(o, in, k);
+        o += k;
+        in += k;
+        n -= k;
+        if (n == 0)
+            break;
+        *o++ = ESCAPE;
+        *o++ = *in++ ^ ESCXOR;
+        n--;
+    }
+    *o++ = FLAG;
+    return o - out;
+}
+
+int deframer_init(struct deframer *d, size_t maxframe)
+{
+    memset(d, 0, sizeof(*d));
+    if ((d->buf = malloc(maxframe)) == NULL)
+        return 0;
+    d->size = maxframe;
+    d->hunting = 1;
+    return 1;
+}
+
+void deframer_free(struct deframer *d)
+{
+    free(d->buf);
+    d->buf = NULL;
+}
+
+/* append k bytes to the frame, or give it up if they do not fit */
+static void collect(struct deframer *d, const uint8_t *p, size_t k)
+{
+    if (d->len + k > d->size) {
+        d->overruns++;
+        d->discarded += d->len + k;
+        d->hunting = 1;
+        d->escaped = 0;
+        return;
+    }
+    memcpy(d->buf + d->len, p, k);
+    d->len += k;
+}
+
+int deframe(struct deframer *d, const uint8_t *in, size_t n,
+            void (*frame)(const uint8_t *buf, size_t len, void *arg), void *arg)
+{
+    const uint8_t *end = in + n;
+    uint8_t c;
+    size_t k;
+    int nframes = 0;
+
+    if (scan == NULL)
+        framing_use(framing_best());
+
+    while (in < end) {
+        if (d->hunting) { /* skip to the next flag, which opens a frame */
+            k = scan(in, end - in);
+            d->discarded += k;
+            in += k;
+            if (in == end)
+                break;
+            if (*in++ == FLAG) {
+                d->hunting = 0;
+                d->len = 0;
+            } else {
+                d->discarded++;
+            }
+            continue;
+        }
+
+        if (d->escaped && *in != FLAG) {
+            c = *in++ ^ ESCXOR;
+            d->escaped = 0;
+            collect(d, &c, 1);
+            continue;
+        }
+
+        k = scan(in, end - in);
+        collect(d, in, k);
+        in += k;
+        if (in == end || d->hunting)
+            continue;
+
+        if (*in++ == ESCAPE) {
+            d->escaped = 1;
+            continue;
+        }
+
+        /* a flag closes the frame, and opens the next */
+        if (d->escaped) {
+            d->aborts++;
+            d->discarded += d->len;
+        } else if (d->len > 0) {
+            frame(d->buf, d->len, arg);
+            d->frames++;
+            nframes++;
+        }
+        d->len = 0;
+        d->escaped = 0;
+    }
+    return nframes;
+}
@@ -0,0 +1,140 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "pool.h"
+
+/*
+ * No job adds jobs, so the pool is done once every deque is empty: a
+ * worker that finds nothing to steal in one pass over its victims exits.
+ * Jobs here are whole simulator runs, so a mutex per deque costs nothing
+ * next to the work it hands out.
+ */
+
+struct deque
+{
+    pthread_mutex_t lock;
+    int *jobs;
+    int head, tail;         /* steal at head, pop at tail */
+};
+
+struct worker
+{
+    pthread_t thread;
+    int id;
+    struct pool *pool;
+};
+
+struct pool
+{
+    int nthreads;
+    struct deque *deques;
+    void (*job)(int index, void *arg);
+    void *arg;
+};
+
+int pool_ncpus(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+static int deque_pop(struct deque *d)
+{
+    int index = -1;
+
+    pthread_mutex_lock(&d->lock);
+    if (d->head < d->tail)
+        index = d->jobs[--d->tail];
+    pthread_mutex_unlock(&d->lock);
+    return index;
+}
+
+static int deque_steal(struct deque *d)
+{
+    int index = -1;
+
+    pthread_mutex_lock(&d->lock);
+    if (d->head < d->tail)
+        index = d->jobs[d->head++];
+    pthread_mutex_unlock(&d->lock);
+    return index;
+}
+
+static void *worker_main(void *p)
+{
+    struct worker *w = p;
+    struct pool *pool = w->pool;
+    int index, i;
+
+    for (;;)
+    {
+        index = deque_pop(&pool->deques[w->id]);
+        for (i = 1; index < 0 && i < pool->nthreads; i++)
+            index = deque_steal(&pool->deques[(w->id + i) % pool->nthreads]);
+        if (index < 0)
+            return NULL;
+        pool->job(index, pool->arg);
+    }
+}
+
+void pool_run(int njobs, int nthreads, void (*job)(int index, void *arg),
+              void *arg)
+{
+    struct pool pool;
+    struct worker *workers;
+    struct deque *d;
+    int i, started = 0;
+
+    if (njobs <= 0)
+        return;
+    if (nthreads <= 0)
+        nthreads = pool_ncpus();
+    if (nthreads > njobs)
+        nthreads = njobs;
+
+    pool.nthreads = nthreads;
+    pool.job = job;
+    pool.arg = arg;
+    pool.deques = calloc(nthreads, sizeof(struct deque));
+    workers = calloc(nthreads, sizeof(struct worker));
+    for (i = 0; i < nthreads; i++)
+    {
+        d = &pool.deques[i];
+        pthread_mutex_init(&d->lock, NULL);
+        d->jobs = malloc((njobs / nthreads + 1) * sizeof(int));
+    }
+    for (i = 0; i < njobs; i++)
+    {
+        d = &pool.deques[i % nthreads];
+        d->jobs[d->tail++] = i;
+    }
+
+    for (i = 0; i < nthreads; i++)
+    {
+        workers[i].id = i;
+        workers[i].pool = &pool;
+        if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]))
+            workers[i].pool = NULL; /* the others steal its share */
+        else
+            started++;
+    }
+    if (started == 0) /* no threads at all: work through it here */
+    {
+        workers[0].pool = &pool;
+        worker_main(&workers[0]);
+        workers[0].pool = NULL;
+    }
+    for (i = 0; i < nthreads; i++)
+        if (workers[i].pool != NULL)
+            pthread_join(workers[i].thread, NULL);
+
+    for (i = 0; i < nthreads; i++)
+    {
+        pthread_mutex_destroy(&pool.deques[i].lock);
+        free(pool.deques[i].jobs);
+    }
+    free(pool.deques);
+    free(workers);
+}
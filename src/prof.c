@@ -0,0 +1,178 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "prof.h"
+
+/*
+ * Each slot counts calls and inclusive cycles: a FROM_LAYER1 dispatch
+ * includes the decode() and tolayer1() it runs, which also have slots
+ * of their own.  Cycles are TSC ticks, converted to time with a
+ * calibration against CLOCK_MONOTONIC over the whole run.
+ */
+
+static const char *names[PROF_NSLOTS] = {
+    "timerinterrupt", "fromlayer3", "fromlayer1", "linksample",
+    "flowtimer", "flowtx", "macarrival",
+    "encode", "decode", "insertevent", "starttimer", "stoptimer",
+    "tolayer1", "printf",
+};
+
+static struct
+{
+    uint64_t calls;
+    uint64_t cycles;
+    uint64_t hw[PROF_NHW];
+} slots[PROF_NSLOTS];
+
+static int hwfd = -1;  /* perf group leader, -1 if unavailable */
+static uint64_t tsc0;
+static struct timespec ts0;
+static struct profmark run0;
+
+static uint64_t ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+static int perf_open(uint64_t config, int group)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = group < 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+static void hw_read(uint64_t *hw)
+{
+    uint64_t buf[1 + PROF_NHW];
+
+    if (hwfd < 0 || read(hwfd, buf, sizeof(buf)) != sizeof(buf)) {
+        memset(hw, 0, PROF_NHW * sizeof(*hw));
+        return;
+    }
+    memcpy(hw, buf + 1, PROF_NHW * sizeof(*hw));
+}
+
+void prof_start(void)
+{
+    if (PROFILE >= 2) {
+        hwfd = perf_open(PERF_COUNT_HW_INSTRUCTIONS, -1);
+        if (hwfd >= 0 && (perf_open(PERF_COUNT_HW_CACHE_MISSES, hwfd) < 0
+                          || perf_open(PERF_COUNT_HW_BRANCH_MISSES, hwfd) < 0)) {
+            close(hwfd);
+            hwfd = -1;
+        }
+        if (hwfd >= 0) {
+            ioctl(hwfd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(hwfd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts0);
+    tsc0 = ticks();
+    prof_begin(&run0);
+}
+
+void prof_begin(struct profmark *m)
+{
+    if (hwfd >= 0)
+        hw_read(m->hw);
+    m->tsc = ticks();
+}
+
+void prof_end(struct profmark *m, int slot)
+{
+    uint64_t t = ticks();
+    uint64_t hw[PROF_NHW];
+    int i;
+
+    if (slot < 0 || slot >= PROF_NSLOTS)
+        return;
+    slots[slot].calls++;
+    slots[slot].cycles += t - m->tsc;
+    if (hwfd >= 0) {
+        hw_read(hw);
+        for (i = 0; i < PROF_NHW; i++)
+            slots[slot].hw[i] += hw[i] - m->hw[i];
+    }
+}
+
+int prof_printf(const char *fmt, ...)
+{
+    struct profmark m;
+    va_list ap;
+    int n;
+
+    prof_begin(&m);
+    va_start(ap, fmt);
+    n = vprintf(fmt, ap);
+    va_end(ap);
+    prof_end(&m, PROF_PRINTF);
+    return n;
+}
+
+void prof_report(void)
+{
+    struct timespec ts;
+    uint64_t total, runhw[PROF_NHW];
+    double nspertick, secs;
+    int i, j;
+
+    total = ticks() - tsc0;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    if (hwfd >= 0) {
+        hw_read(runhw);
+        for (j = 0; j < PROF_NHW; j++)
+            runhw[j] -= run0.hw[j];
+    }
+    secs = (ts.tv_sec - ts0.tv_sec) + (ts.tv_nsec - ts0.tv_nsec) * 1e-9;
+    nspertick = total ? secs * 1e9 / total : 0;
+
+    printf("\n Profile: %.6f s, %llu cycles (%.3f ns/cycle)\n", secs,
+           (unsigned long long)total, nspertick);
+    printf(" %-16s %10s %14s %12s %8s", "slot", "calls", "cycles",
+           "cycles/call", "% run");
+    if (hwfd >= 0)
+        printf(" %12s %12s %12s", "instr/call", "cmiss/call", "bmiss/call");
+    printf("\n");
+    for (i = 0; i < PROF_NSLOTS; i++) {
+        if (slots[i].calls == 0)
+            continue;
+        printf(" %-16s %10llu %14llu %12.1f %8.2f", names[i],
+               (unsigned long long)slots[i].calls,
+               (unsigned long long)slots[i].cycles,
+               (double)slots[i].cycles / slots[i].calls,
+               total ? 100.0 * slots[i].cycles / total : 0);
+        for (j = 0; hwfd >= 0 && j < PROF_NHW; j++)
+            printf(" %12.1f", (double)slots[i].hw[j] / slots[i].calls);
+        printf("\n");
+    }
+    if (hwfd >= 0)
+        printf(" whole run: %llu instructions, %llu cache misses, %llu branch misses\n",
+               (unsigned long long)runhw[0], (unsigned long long)runhw[1],
+               (unsigned long long)runhw[2]);
+    else if (PROFILE >= 2)
+        printf(" hardware counters unavailable (perf_event_open failed)\n");
+}
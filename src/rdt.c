@@ -1,9 +1,28 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <math.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/time.h>
+
+#include "crc.h"
+#include "prof.h"
+#include "pool.h"
+#include "app.h"
+#include "framing.h"
+
+#if PROFILE
+#define printf prof_printf /* time the trace output as well */
+#endif
 
 /* ******************************************************************
  ALTERNATING BIT AND GO-BACK-N NETWORK EMULATOR: SLIGHTLY MODIFIED
@@ -47,13 +66,22 @@ struct frm
     int acknum;
     int checksum;
     char payload[4];
+    uint8_t parity[4]; /* FEC check bytes, if fecmode is set */
+    int connid;        /* flow the frame belongs to, if nflows is set */
 };
 
+#define FRMBYTES 8 /* payload, seqnum, acknum, type, checksum */
+#define FECMAX 4   /* room for FEC check bytes in a frame */
+#define CONNIDBYTES 3 /* connection ID bytes in the header in flow mode */
+#define MAXFLOWS (1 << (8 * CONNIDBYTES))
+#define FRMMAX (FRMBYTES + CONNIDBYTES) /* largest header, before FEC */
+
 /********* FUNCTION PROTOTYPES. DEFINED IN THE LATER PART******************/
 void starttimer(int AorB, float increment);
 void stoptimer(int AorB);
+float gettime(void);
 void tolayer1(int AorB, struct frm frame);
-void tolayer3(int AorB, char datasent[20]);
+void tolayer3(int AorB, char datasent[4]);
 
 /********* STUDENTS WRITE THE NEXT SEVEN ROUTINES *********/
 
@@ -62,6 +90,8 @@ enum State {
     WAITING_FOR_ACK
 };
 
+#define SENDQMAX 64 /* largest send queue that can be configured */
+
 struct Entity {
     enum State state;
     bool outstandingACK;
@@ -70,8 +100,29 @@ struct Entity {
     float timerInterrupt;
     struct frm lastFrame;
     int lastACK;
+
+    /* packets from layer 3 waiting for the previous frame's ACK */
+    struct pkt sendq[SENDQMAX];
+    float enqueued[SENDQMAX]; /* when each packet was queued */
+    int qhead, qcount;
+    float qchanged;           /* last time qcount changed */
+    float depthtime;          /* integral of qcount over time */
+    int maxdepth;
+    int nqueued, nrefused, ndequeued;
+    float waitsum, waitmax;   /* time packets spent in the queue */
+
+    /* recovery of lastFrame */
+    float firstsent;          /* when it was first sent */
+    float lastsent;           /* when it was last sent, for any reason */
+    int resends;              /* times it was resent */
+    int fastsends;            /* of which on a NACK */
 }A, B;
 
+struct Entity *get_entity(int AorB)
+{
+    return AorB == 0 ? &A : &B;
+}
+
 int inc_seq(int seq) {
     /* Since the sequence is alternating
      * it can have only two values: 0 and 1. */
@@ -81,14 +132,41 @@ int inc_seq(int seq) {
 int showcrcsteps;  /* show the CRC steps (1) or not (0) */
 int piggybacking;  /* do piggybacking (1) or not (0) */
 uint8_t generator; /* the CRC generator polynomial */
+int sendqdepth;    /* packets held while waiting for an ACK (0: drop them) */
+int nflows;        /* multiplexed flows from A to B (0: the entities above) */
+
+#define FEC_NONE 0
+#define FEC_SECDED 1 /* extended Hamming, corrects 1 bit per frame */
+#define FEC_RS 2     /* Reed-Solomon, corrects rsparity/2 bytes per frame */
+
+int fecmode;       /* one of FEC_* */
+int rsparity;      /* Reed-Solomon check bytes: 2 or 4 */
+int nfecrepaired;  /* frames repaired by FEC */
+int nfecfailed;    /* frames FEC found damaged beyond repair */
+int nretransmit;   /* frames resent after a timeout */
+
+int fastretransmit;  /* resend on a NACK (1) or wait for the timer (0) */
+float fastholdoff;   /* NACKs this soon after a send answer an older copy */
+int fastmax;         /* NACK resends of one frame before leaving it to the timer */
+int nfastretransmit; /* frames resent on a NACK */
+int nfastsuppressed; /* NACKs ignored by fastholdoff and fastmax */
+int nrecovered;      /* frames ACKed after at least one resend */
+float recoverytime;  /* sum of their times from first send to ACK */
 
 void send_ack(int AorB, bool isAck, int ack);
 void entity_init(struct Entity* entity);
-void entity_output(int AorB, struct pkt packet);
+int entity_output(int AorB, struct pkt packet);
 void entity_input(int AorB, struct frm frame);
 void entity_timerinterrupt(int AorB);
+void entity_fastretransmit(int AorB, struct Entity *entity);
+void entity_acked(struct Entity *entity);
 void printbinchar(char c);
 void printgenerator();
+int frm_hdrbytes(void);
+int frm_to_bytes(struct frm *frame, uint8_t *buf);
+void frm_from_bytes(uint8_t *buf, struct frm *frame);
+void fec_encode(struct frm *frame);
+int fec_decode(struct frm *frame);
 
 
 /*
@@ -107,8 +185,18 @@ int get_checksum(struct frm *frame) {
     return checksum;
 }
 
+/*
+ * Returns the CRC remainder of len bytes of input, MSB first.
+ */
+uint8_t crc8(const uint8_t *input, int len)
+{
+    return crc8_bitwise(input, len, generator);
+}
+
 uint8_t encode(struct frm *frame)
 {
+    PROF_BEGIN(encode);
+
     /*
      * NOTE: a byte is the same as uint8_t
      */
@@ -116,7 +204,7 @@ uint8_t encode(struct frm *frame)
     /**
      * Length of input message (dividend) in bytes.
      */
-    int len = 4 + 3;
+    int len = 4 + 3 + (nflows > 0 ? CONNIDBYTES : 0);
 
     /**
      * The input message in bytes.
@@ -132,34 +220,15 @@ uint8_t encode(struct frm *frame)
     if (frame->type == DATA) input[6] = 0;
     if (frame->type == ACK) input[6] = 1;
     if (frame->type == PACK) input[6] = 2;
+    if (nflows > 0) /* the connection ID is covered too, high byte first */
+        for (int i = 0; i < CONNIDBYTES; i++)
+            input[7 + i] = frame->connid >> 8 * (CONNIDBYTES - 1 - i);
     // input[7] = '\0';
 
     /**
      * The byte which will hold the value of CRC remainder.
      */
-    uint8_t crc = 0;
-
-    uint8_t c;
-
-    for (int i = 0; i < len; i++) {
-        /* Take one byte from input. */
-        c = input[i];
-
-        /* XOR it with CRC register and put it in. */
-        crc ^= c;
-
-        for (int j = 0; j < 8; j++) {
-
-            /* If MSB of CRC is 1, LShift and XOR with generator.
-             * Otherwise, just do LShift.
-             *
-             * 0x80 == 0b10000000 */
-            if (crc & 0x80)
-                crc = (crc << 1 ) ^ generator;
-            else
-                crc <<= 1;
-        }
-    }
+    uint8_t crc = crc8(input, len);
 
     if (showcrcsteps) {
         printf("ENCODING...\n");
@@ -172,6 +241,7 @@ uint8_t encode(struct frm *frame)
     }
     // frame->checksum = crc;
     free(input);
+    PROF_END(encode, PROF_ENCODE);
     return crc;
 }
 
@@ -180,11 +250,13 @@ uint8_t encode(struct frm *frame)
  */
 uint8_t decode(struct frm *frame)
 {
+    PROF_BEGIN(decode);
+
     /*
      * Code is the same as #encode()
      * except this time the checksum element will be appended to input.
      */
-    int len = 4 + 4;
+    int len = 4 + 4 + (nflows > 0 ? CONNIDBYTES : 0);
     uint8_t *input = (uint8_t*) malloc(len * sizeof(uint8_t));
     for (int i = 0; i < 4; i++) input[i] = frame->payload[i];
     input[4] = frame->seqnum;
@@ -192,23 +264,13 @@ uint8_t decode(struct frm *frame)
     if (frame->type == DATA) input[6] = 0;
     if (frame->type == ACK) input[6] = 1;
     if (frame->type == PACK) input[6] = 2;
-    input[7] = frame->checksum;
+    if (nflows > 0)
+        for (int i = 0; i < CONNIDBYTES; i++)
+            input[7 + i] = frame->connid >> 8 * (CONNIDBYTES - 1 - i);
+    input[len - 1] = frame->checksum;
     // input[7] = '\0';
 
-    uint8_t c;
-    uint8_t crc = 0;
-
-    for (int i = 0; i < len; i++) {
-        c = input[i];
-        crc ^= c;
-
-        for (int j = 0; j < 8; j++) {
-            if (crc & 0x80)
-                crc = (crc << 1 ) ^ generator;
-            else
-                crc <<= 1;
-        }
-    }
+    uint8_t crc = crc8(input, len);
 
     if (showcrcsteps) {
         printf("DECODING...\n");
@@ -220,23 +282,261 @@ uint8_t decode(struct frm *frame)
         printf("DECODED\n");
     }
     free(input);
+    PROF_END(decode, PROF_DECODE);
     return crc;
 }
 
-void entity_output(int AorB, struct pkt packet)
+/**
+ * Puts the CRC remainders of n frames in rem: the values decode() gives
+ * one frame at a time, computed in SIMD batches.
+ */
+void decode_batch(struct frm *frames, int n, uint8_t *rem)
 {
-    struct Entity *entity;
-    if (AorB == 0) entity = &A;
-    else entity = &B;
+    uint8_t buf[FRMMAX + FECMAX];
+    uint8_t *msgs = (uint8_t*) malloc(n * CRCMSGLEN * sizeof(uint8_t));
 
-    if (entity->state != WAITING_FOR_LAYER3) {
-        if (AorB == 0)
-            printf("  A_output: Packet dropped. ACK not yet received.\n");
-        else
-            printf("  B_output: Packet dropped. ACK not yet received.\n");
-        return;
+    for (int i = 0; i < n; i++) {
+        frm_to_bytes(&frames[i], buf);
+        memcpy(msgs + i * CRCMSGLEN, buf, CRCMSGLEN);
+    }
+    crc8_batch(msgs, n, generator, rem);
+    free(msgs);
+}
+
+/*************************** FORWARD ERROR CORRECTION ****************/
+/* Optional FEC between entity_output() and tolayer1(): the sender adds */
+/* check bytes after the CRC is computed and the receiver repairs the   */
+/* frame before decode() looks at it, so the CRC stays the final check. */
+/*   FEC_SECDED: extended Hamming (72,64) over the 8 frame bytes, or    */
+/*               (96,88) with a connection ID; one check byte corrects */
+/*               any 1 bit and detects 2.                               */
+/*   FEC_RS:     Reed-Solomon over GF(256) with rsparity check bytes;   */
+/*               corrects rsparity/2 damaged bytes anywhere in frame.   */
+/* Both are table driven: syndromes are XORs of precomputed bytes.      */
+
+uint8_t secded_syn[FRMMAX][256]; /* syndrome of each byte value at each position */
+int8_t secded_bit[256];            /* data bit in error for a syndrome, or -1 */
+uint8_t gf_exp[512];               /* GF(256) antilog, doubled to skip a mod */
+uint8_t gf_log[256];
+uint8_t rs_gen[FECMAX + 1];        /* RS generator polynomial, highest first */
+uint8_t rs_enc[256][FECMAX];       /* remainder contributed by a feedback byte */
+
+int fec_nbytes(void)
+{
+    if (fecmode == FEC_SECDED)
+        return 1;
+    if (fecmode == FEC_RS)
+        return rsparity;
+    return 0;
+}
+
+uint8_t gf_mul(uint8_t a, uint8_t b)
+{
+    if (a == 0 || b == 0)
+        return 0;
+    return gf_exp[gf_log[a] + gf_log[b]];
+}
+
+uint8_t gf_div(uint8_t a, uint8_t b)
+{
+    if (a == 0)
+        return 0;
+    return gf_exp[gf_log[a] + 255 - gf_log[b]];
+}
+
+void fec_init(void)
+{
+    int i, j, w, col, x;
+
+    /* SECDED: give data bit i a distinct odd-weight (>= 3) column, so */
+    /* a single error has an odd syndrome and a double error an even one */
+    memset(secded_bit, -1, sizeof(secded_bit));
+    for (col = 0, i = 0; col < 256 && i < FRMMAX * 8; col++) {
+        for (w = 0, x = col; x; x >>= 1)
+            w += x & 1;
+        if (w < 3 || w % 2 == 0)
+            continue;
+        secded_bit[col] = i;
+        for (x = 0; x < 256; x++)
+            if (x & (0x80 >> (i % 8)))
+                secded_syn[i / 8][x] ^= col;
+        i++;
+    }
+
+    /* GF(256) with the primitive polynomial x^8+x^4+x^3+x^2+1 */
+    for (i = 0, x = 1; i < 255; i++) {
+        gf_exp[i] = gf_exp[i + 255] = x;
+        gf_log[x] = i;
+        x <<= 1;
+        if (x & 0x100)
+            x ^= 0x11d;
+    }
+
+    /* RS generator: product of (x - a^i) for i = 0 .. rsparity-1 */
+    memset(rs_gen, 0, sizeof(rs_gen));
+    rs_gen[0] = 1;
+    for (i = 0; i < rsparity; i++) {
+        for (j = i + 1; j > 0; j--)
+            rs_gen[j] ^= gf_mul(rs_gen[j - 1], gf_exp[i]);
     }
+    for (x = 0; x < 256; x++)
+        for (j = 0; j < rsparity; j++)
+            rs_enc[x][j] = gf_mul(x, rs_gen[j + 1]);
+}
+
+void secded_encode(uint8_t *buf)
+{
+    int n = frm_hdrbytes();
+    uint8_t syn = 0;
+    for (int i = 0; i < n; i++)
+        syn ^= secded_syn[i][buf[i]];
+    buf[n] = syn;
+}
+
+/* returns bits corrected, or -1 if the damage can not be repaired */
+int secded_decode(uint8_t *buf)
+{
+    int n = frm_hdrbytes(), w, x;
+    uint8_t syn = buf[n];
+
+    for (int i = 0; i < n; i++)
+        syn ^= secded_syn[i][buf[i]];
+    if (syn == 0)
+        return 0;
+    for (w = 0, x = syn; x; x >>= 1)
+        w += x & 1;
+    if (w == 1) { /* a check bit flipped, the data is intact */
+        buf[n] ^= syn;
+        return 1;
+    }
+    if (secded_bit[syn] < 0)
+        return -1;
+    buf[secded_bit[syn] / 8] ^= 0x80 >> (secded_bit[syn] % 8);
+    return 1;
+}
+
+void rs_encode(uint8_t *buf)
+{
+    int n = frm_hdrbytes(), i, j;
+    uint8_t *par = buf + n;
+    uint8_t fb;
+
+    memset(par, 0, rsparity);
+    for (i = 0; i < n; i++) {
+        fb = buf[i] ^ par[0];
+        for (j = 0; j < rsparity - 1; j++)
+            par[j] = par[j + 1] ^ rs_enc[fb][j];
+        par[rsparity - 1] = rs_enc[fb][rsparity - 1];
+    }
+}
+
+/* returns bytes corrected, or -1 if the damage can not be repaired */
+int rs_decode(uint8_t *buf)
+{
+    int n = frm_hdrbytes() + rsparity;
+    uint8_t syn[FECMAX], lambda[FECMAX + 1], prev[FECMAX + 1], t[FECMAX + 1];
+    uint8_t omega[FECMAX], d, b, xinv, num, den;
+    int i, j, l, m, nerr, bad;
+
+    /* syndromes: the received word evaluated at the generator's roots */
+    for (bad = 0, j = 0; j < rsparity; j++) {
+        for (syn[j] = 0, i = 0; i < n; i++)
+            syn[j] = gf_mul(syn[j], gf_exp[j]) ^ buf[i];
+        bad |= syn[j];
+    }
+    if (!bad)
+        return 0;
+
+    /* Berlekamp-Massey: shortest LFSR (error locator) for the syndromes */
+    memset(lambda, 0, sizeof(lambda));
+    memset(prev, 0, sizeof(prev));
+    lambda[0] = prev[0] = 1;
+    l = 0; m = 1; b = 1;
+    for (i = 0; i < rsparity; i++) {
+        for (d = syn[i], j = 1; j <= l; j++)
+            d ^= gf_mul(lambda[j], syn[i - j]);
+        if (d == 0) {
+            m++;
+            continue;
+        }
+        memcpy(t, lambda, sizeof(t));
+        for (j = 0; j + m <= rsparity; j++)
+            lambda[j + m] ^= gf_mul(gf_div(d, b), prev[j]);
+        if (2 * l <= i) {
+            l = i + 1 - l;
+            memcpy(prev, t, sizeof(prev));
+            b = d;
+            m = 1;
+        } else
+            m++;
+    }
+    if (2 * l > rsparity)
+        return -1;
+
+    /* error evaluator: syndromes times locator, mod x^rsparity */
+    for (i = 0; i < rsparity; i++)
+        for (omega[i] = 0, j = 0; j <= i; j++)
+            omega[i] ^= gf_mul(syn[i - j], lambda[j]);
+
+    /* Chien search over the n positions, Forney for each magnitude */
+    for (nerr = 0, i = 0; i < n; i++) {
+        xinv = gf_exp[(255 - (n - 1 - i)) % 255]; /* X^-1 for position i */
+        for (num = 0, j = l; j >= 0; j--)
+            num = gf_mul(num, xinv) ^ lambda[j];
+        if (num != 0)
+            continue;
+        for (num = 0, j = rsparity - 1; j >= 0; j--)
+            num = gf_mul(num, xinv) ^ omega[j];
+        for (den = 0, j = l - (l % 2 == 0); j >= 1; j -= 2) /* formal derivative */
+            den ^= gf_mul(lambda[j], gf_exp[(gf_log[xinv] * (j - 1)) % 255]);
+        if (den == 0)
+            return -1;
+        buf[i] ^= gf_div(gf_mul(num, gf_exp[n - 1 - i]), den);
+        nerr++;
+    }
+    return nerr == l ? nerr : -1;
+}
+
+/* add check bytes to a frame whose checksum is already set */
+void fec_encode(struct frm *frame)
+{
+    uint8_t buf[FRMMAX + FECMAX];
+
+    frm_to_bytes(frame, buf);
+    if (fecmode == FEC_SECDED)
+        secded_encode(buf);
+    else
+        rs_encode(buf);
+    memcpy(frame->parity, buf + frm_hdrbytes(), fec_nbytes());
+}
+
+/* repair a received frame in place; returns the bits (SECDED) or bytes */
+/* (RS) corrected, or -1 if the damage is beyond repair                 */
+int fec_decode(struct frm *frame)
+{
+    uint8_t buf[FRMMAX + FECMAX];
+    int fixed;
 
+    frm_to_bytes(frame, buf);
+    if (fecmode == FEC_SECDED)
+        fixed = secded_decode(buf);
+    else
+        fixed = rs_decode(buf);
+    if (fixed > 0)
+        frm_from_bytes(buf, frame);
+    return fixed;
+}
+
+void sendq_account(struct Entity *entity)
+{
+    float now = gettime();
+    entity->depthtime += entity->qcount * (now - entity->qchanged);
+    entity->qchanged = now;
+}
+
+/* build a frame for packet and send it; the entity must be idle */
+void send_packet(int AorB, struct Entity *entity, struct pkt packet)
+{
     /* create a frame to send B */
     struct frm frame;
 
@@ -252,11 +552,15 @@ void entity_output(int AorB, struct pkt packet)
     }
 
     memmove(frame.payload, packet.data, 4);
+    frame.connid = 0;
     // frame.checksum = get_checksum(&frame);
     frame.checksum = encode(&frame);
+    if (fecmode) fec_encode(&frame);
 
     /* send the frame to B */
     entity->lastFrame = frame;
+    entity->firstsent = entity->lastsent = gettime();
+    entity->resends = entity->fastsends = 0;
     entity->state = WAITING_FOR_ACK;
     entity->outstandingACK = false;
     tolayer1(AorB, frame);
@@ -268,16 +572,97 @@ void entity_output(int AorB, struct pkt packet)
         printf("  B_output: Frame sent: %s:%d.\n", frame.payload, frame.type);
 }
 
+/*
+ * Returns 1 if the packet was accepted (sent or queued) and 0 if layer 3
+ * must hold it back because the send queue is full.
+ */
+int entity_output(int AorB, struct pkt packet)
+{
+    struct Entity *entity;
+    if (AorB == 0) entity = &A;
+    else entity = &B;
+
+    if (entity->state != WAITING_FOR_LAYER3 && sendqdepth == 0) {
+        if (AorB == 0)
+            printf("  A_output: Packet dropped. ACK not yet received.\n");
+        else
+            printf("  B_output: Packet dropped. ACK not yet received.\n");
+        entity->nrefused++;
+        return 0;
+    }
+
+    if (entity->state != WAITING_FOR_LAYER3 || entity->qcount > 0) {
+        if (entity->qcount == sendqdepth) {
+            if (AorB == 0)
+                printf("  A_output: Packet refused. Send queue full.\n");
+            else
+                printf("  B_output: Packet refused. Send queue full.\n");
+            entity->nrefused++;
+            return 0;
+        }
+        sendq_account(entity);
+        int tail = (entity->qhead + entity->qcount) % SENDQMAX;
+        entity->sendq[tail] = packet;
+        entity->enqueued[tail] = gettime();
+        entity->qcount++;
+        entity->nqueued++;
+        if (entity->qcount > entity->maxdepth)
+            entity->maxdepth = entity->qcount;
+        if (AorB == 0)
+            printf("  A_output: Packet queued. ACK not yet received.\n");
+        else
+            printf("  B_output: Packet queued. ACK not yet received.\n");
+        return 1;
+    }
+
+    send_packet(AorB, entity, packet);
+    return 1;
+}
+
+/* whether entity_output() would take a packet now */
+int entity_can_accept(int AorB)
+{
+    struct Entity *entity;
+    if (AorB == 0) entity = &A;
+    else entity = &B;
+
+    if (entity->state == WAITING_FOR_LAYER3 && entity->qcount == 0)
+        return 1;
+    return entity->qcount < sendqdepth;
+}
+
+/* send the oldest queued packet once the entity is free again */
+void sendq_drain(int AorB)
+{
+    struct Entity *entity;
+    if (AorB == 0) entity = &A;
+    else entity = &B;
+
+    if (entity->state != WAITING_FOR_LAYER3 || entity->qcount == 0)
+        return;
+
+    float wait = gettime() - entity->enqueued[entity->qhead];
+    struct pkt packet = entity->sendq[entity->qhead];
+    sendq_account(entity);
+    entity->qhead = (entity->qhead + 1) % SENDQMAX;
+    entity->qcount--;
+    entity->ndequeued++;
+    entity->waitsum += wait;
+    if (wait > entity->waitmax)
+        entity->waitmax = wait;
+    send_packet(AorB, entity, packet);
+}
+
 /* called from layer 3, passed the data to be sent to other side */
-void A_output(struct pkt packet)
+int A_output(struct pkt packet)
 {
-    entity_output(0, packet);
+    return entity_output(0, packet);
 }
 
 /* need be completed only for extra credit */
-void B_output(struct pkt packet)
+int B_output(struct pkt packet)
 {
-    entity_output(1, packet);
+    return entity_output(1, packet);
 }
 
 void entity_input(int AorB, struct frm frame)
@@ -286,6 +671,19 @@ void entity_input(int AorB, struct frm frame)
     if (AorB == 0) entity = &A;
     else entity = &B;
 
+    if (fecmode) {
+        int fixed = fec_decode(&frame);
+        if (fixed > 0) {
+            nfecrepaired++;
+            if (AorB == 0)
+                printf("  A_input: Frame repaired by FEC.\n");
+            else
+                printf("  B_input: Frame repaired by FEC.\n");
+        } else if (fixed < 0) {
+            nfecfailed++;
+        }
+    }
+
     if (frame.type == ACK) {
         if (entity->state != WAITING_FOR_ACK) {
             if (AorB == 0)
@@ -309,6 +707,7 @@ void entity_input(int AorB, struct frm frame)
                 printf("  A_input: ACK dropped. Not the expected ACK.\n");
             else
                 printf("  B_input: ACK dropped. Not the expected ACK.\n");
+            entity_fastretransmit(AorB, entity);
             return;
         }
 
@@ -318,9 +717,11 @@ void entity_input(int AorB, struct frm frame)
             printf("  B_input: ACK received.\n");
 
         /* get ready for sendig next packet */
+        entity_acked(entity);
         stoptimer(AorB);
         entity->outgoingSeq = inc_seq(entity->outgoingSeq);
         entity->state = WAITING_FOR_LAYER3;
+        sendq_drain(AorB);
     }
     else if (frame.type == DATA) {
         // if (frame.checksum != get_checksum(&frame)) {
@@ -377,6 +778,7 @@ void entity_input(int AorB, struct frm frame)
                 printf("  A_input: PACK dropped. Not the expected ACK.\n");
             else
                 printf("  B_input: PACK dropped. Not the expected ACK.\n");
+            entity_fastretransmit(AorB, entity);
             return;
         }
 
@@ -386,6 +788,7 @@ void entity_input(int AorB, struct frm frame)
             printf("  B_input: PACK received: %s:%d\n", frame.payload, frame.type);
         }
 
+        entity_acked(entity);
         stoptimer(AorB);
         entity->outgoingSeq = inc_seq(entity->outgoingSeq);
         entity->state = WAITING_FOR_LAYER3;
@@ -394,6 +797,7 @@ void entity_input(int AorB, struct frm frame)
 
         tolayer3(AorB, frame.payload);
         entity->incomingSeq = inc_seq(entity->incomingSeq);
+        sendq_drain(AorB);
     }
 }
 
@@ -429,9 +833,58 @@ void entity_timerinterrupt(int AorB)
     else
         printf("  B_timerinterrupt: Resend last frame: %s:%d.\n", B.lastFrame.payload, B.lastFrame.type);
 
+    nretransmit++;
+    entity->resends++;
+    entity->lastsent = gettime();
+    tolayer1(AorB, entity->lastFrame);
+    starttimer(AorB, entity->timerInterrupt);
+}
+
+/*
+ * An ACK for the other sequence number is the receiver's NACK, or a
+ * duplicate ACK: lastFrame did not arrive intact, so resend it without
+ * waiting for the timer.  A timeout can leave two copies in flight, and
+ * if each NACK resent a copy every one of them would keep itself alive;
+ * a NACK that comes sooner than fastholdoff after the last send can only
+ * answer an older copy, and after fastmax resends the timer takes over.
+ */
+void entity_fastretransmit(int AorB, struct Entity *entity)
+{
+    if (!fastretransmit || entity->state != WAITING_FOR_ACK)
+        return;
+
+    if (entity->fastsends >= fastmax ||
+        gettime() - entity->lastsent < fastholdoff) {
+        if (AorB == 0)
+            printf("  A_input: Fast retransmit suppressed.\n");
+        else
+            printf("  B_input: Fast retransmit suppressed.\n");
+        nfastsuppressed++;
+        return;
+    }
+
+    if (AorB == 0)
+        printf("  A_input: Fast retransmit: %s:%d.\n", A.lastFrame.payload, A.lastFrame.type);
+    else
+        printf("  B_input: Fast retransmit: %s:%d.\n", B.lastFrame.payload, B.lastFrame.type);
+
+    nfastretransmit++;
+    entity->fastsends++;
+    entity->resends++;
+    entity->lastsent = gettime();
+    stoptimer(AorB);
     tolayer1(AorB, entity->lastFrame);
     starttimer(AorB, entity->timerInterrupt);
 }
+
+/* lastFrame got through: account for how long that took if it was resent */
+void entity_acked(struct Entity *entity)
+{
+    if (entity->resends > 0) {
+        nrecovered++;
+        recoverytime += gettime() - entity->firstsent;
+    }
+}
 /* called when A's timer goes off */
 void A_timerinterrupt(void)
 {
@@ -470,12 +923,14 @@ void send_ack(int AorB, bool isAck, int ack)
                 printf("  B_input: Send NACK.\n");
         }
         struct frm frame;
+        memset(&frame, 0, sizeof(frame)); /* ACKs carry no payload */
         frame.type = ACK;
         frame.seqnum = entity->incomingSeq;
         if (piggybacking) frame.acknum = entity->lastACK;
         else frame.acknum = ack;
         // frame.checksum = get_checksum(&frame);
         frame.checksum = encode(&frame);
+        if (fecmode) fec_encode(&frame);
         tolayer1(AorB, frame);
         entity->outstandingACK = false;
     }
@@ -487,6 +942,7 @@ void entity_init(struct Entity* entity)
     entity->incomingSeq = 0;
     entity->outgoingSeq = 0;
     entity->timerInterrupt = 100;
+    entity->qhead = entity->qcount = 0;
 }
 
 /* the following routine will be called once (only) before any other */
@@ -526,6 +982,10 @@ struct event
     int evtype;         /* event type code */
     int eventity;       /* entity where event occurs */
     struct frm *frmptr; /* ptr to frame (if any) assoc w/ this event */
+    int corrupted;      /* frame (if any) was damaged in the medium */
+    struct frm *origptr; /* the frame as sent, if it was damaged */
+    uint8_t *wire;      /* the frame as stuffed bytes, if framing */
+    int wirelen;
     struct event *prev;
     struct event *next;
 };
@@ -535,6 +995,10 @@ struct event *evlist = NULL; /* the event list */
 #define TIMER_INTERRUPT 0
 #define FROM_LAYER3 1
 #define FROM_LAYER1 2
+#define LINK_SAMPLE 3
+#define FLOW_TIMER 4 /* the timing wheel of the flows ticks */
+#define FLOW_TX 5    /* A's transmit queue has room for another flow's frame */
+#define MAC_ARRIVAL 6 /* a new frame for some station on the shared medium */
 
 #define OFF 0
 #define ON 1
@@ -548,14 +1012,199 @@ float time = 0.000;
 float lossprob;    /* probability that a frame is dropped  */
 float corruptprob; /* probability that one bit is frame is flipped */
 float lambda;      /* arrival rate of packets from layer 3 */
+unsigned int seed = 9999; /* seed for rand() */
+unsigned long nrand; /* number of rand() draws since srand(seed) */
 int ntolayer1;     /* number sent into layer 1 */
 int nlost;         /* number lost in media */
 int ncorrupt;      /* number corrupted by media*/
 
+/* channel models, selected per case in init() */
+#define LOSS_BERNOULLI 0 /* each frame lost independently with lossprob */
+#define LOSS_GILBERT 1   /* Gilbert-Elliott two-state burst loss */
+#define LOSS_TRACE 2     /* loss pattern read from a trace file */
+#define CORRUPT_FIELD 0  /* overwrite one field of the frame */
+#define CORRUPT_BER 1    /* flip bits of the serialized frame */
+
+int lossmodel;       /* one of LOSS_* */
+int corruptmodel;    /* one of CORRUPT_* */
+float ber;           /* bit error rate for CORRUPT_BER */
+float gegood2bad;    /* Gilbert-Elliott: P(good -> bad) after a frame */
+float gebad2good;    /* Gilbert-Elliott: P(bad -> good) after a frame */
+float gelossgood;    /* Gilbert-Elliott: loss probability in good state */
+float gelossbad;     /* Gilbert-Elliott: loss probability in bad state */
+char losstrace[256]; /* trace file: one '0' (deliver) or '1' (lose) per frame */
+int nbitflips;       /* number of bits flipped by media */
+int nundetected;     /* number of corrupted frames the CRC did not catch */
+#define UNDETBATCH 256
+struct frm undetframes[UNDETBATCH]; /* damaged frames still to be checked */
+int nundetframes;
+
+/* framing: frames cross layer 1 as a flag delimited, byte stuffed stream */
+int framing;         /* stuff frames onto a byte stream (1) or not (0) */
+struct deframer deframers[2]; /* each receiver's view of the stream */
+long nwirebytes;     /* stuffed bytes put onto the stream */
+long nescaped;       /* of which escapes added by stuffing */
+int nbadlength;      /* frames the deframer found of the wrong length */
+
+/* link model: rate, delay and a finite transmit queue at each sender */
+#define QUEUE_TAILDROP 0 /* drop arriving frames when the queue is full */
+#define QUEUE_RED 1      /* random early detection on the average depth */
+#define LINKQMAX 64      /* largest transmit queue that can be configured */
+
+int linkmodel;       /* model the link (1) or use 1-10 unit delays (0) */
+float bandwidth;     /* link rate in bytes per time unit */
+float propdelay;     /* propagation delay in time units */
+float jitter;        /* extra delay, uniform on [0,jitter] */
+int qlimit;          /* transmit queue capacity in frames */
+int qdiscipline;     /* QUEUE_TAILDROP or QUEUE_RED */
+float redminth;      /* RED: no drops below this average depth */
+float redmaxth;      /* RED: drop everything above this average depth */
+float redmaxp;       /* RED: drop probability at redmaxth */
+float redweight;     /* RED: weight of the newest sample in the average */
+float statinterval;  /* print link utilization every statinterval units */
+int nqdrop;          /* number dropped at a full transmit queue */
+int nblocked;        /* packets layer 2 refused to take from layer 3 */
+struct pkt heldpkt[2]; /* the packet layer 2 refused last, to offer again */
+int held[2];
+
+/* layer 3 traffic: the original single arrival process, or a source */
+/* per direction, each with its own rate                             */
+#define SRC_NONE 0     /* sends nothing */
+#define SRC_POISSON 1  /* exponential gaps at rate packets per unit */
+#define SRC_ONOFF 2    /* Poisson at rate during exponential on periods */
+#define SRC_CBR 3      /* one packet every 1/rate units */
+#define SRC_TRACE 4    /* arrival times read from a file */
+#define SRC_SATURATE 5 /* always backlogged: offers whenever layer 2 can take */
+
+struct source
+{
+    int type;            /* one of SRC_* */
+    float rate;          /* packets per time unit (peak rate for on/off) */
+    float onmean;        /* on/off: mean length of an on period */
+    float offmean;       /* on/off: mean length of an off period */
+    char tracefile[256]; /* trace: lines of arrival times, increasing */
+    float onend;         /* on/off: when the current on period ends */
+    long tracepos;       /* trace: next line to use */
+};
+
+int traffic;              /* use sources[] (1) or the original process (0) */
+struct source sources[2]; /* indexed by the entity the packets come from */
+int ndelivered[2];        /* packets handed to layer 3 at each entity */
+
+/* multiplexed flows: nflows connections from A to B share A's link,    */
+/* each with its own sequence numbers and retransmission timer          */
+#define SCHED_FIFO 0 /* flows get the link in the order they become ready */
+#define SCHED_DRR 1  /* deficit round robin: equal shares of the bytes */
+
+int flowsizes;            /* flow i's frames are 1 + i % flowsizes frames long */
+int flowsched;            /* one of SCHED_* */
+float flowtimeout;        /* retransmission timeout of every flow */
+float wheeltick;          /* resolution of the flow timers */
+
+/* shared medium: the flows are stations contending for one channel */
+#define MAC_NONE 0   /* A's link, as above */
+#define MAC_ALOHA 1  /* slotted ALOHA */
+#define MAC_CSMACD 2 /* 1-persistent CSMA/CD with binary exponential backoff */
+#define MAC_TOKEN 3  /* token passing */
+
+int macmode;              /* one of MAC_* */
+int macframe;             /* ticks a frame holds the medium for */
+float macload;            /* new frames per frame time, all stations together */
+float macretry;           /* slotted ALOHA: chance of a retry in each slot */
+const char *macnames[] = { "none", "slotted ALOHA", "CSMA/CD", "token passing" };
+
+/* layer 3 pipeline: packets come from and go to the application threads */
+/* of app.c through lock-free rings instead of being made up and dropped */
+int pipeline;             /* use the application (1) or not (0) */
+struct appstats pipestats;
+int reportfd = -1;        /* the report while stdout goes to /dev/null */
+
+/* file transfer: A sends a file, B writes what it receives to another */
+char xferfile[256];       /* file A sends, "" for made up packets */
+char xferout[256];        /* where B writes it */
+uint8_t *xfersrc;         /* both files, mapped */
+uint8_t *xferdst;
+size_t xfersize;
+size_t xferread;          /* bytes layer 2 has taken from xfersrc */
+size_t xferwritten;       /* bytes B has written to xferdst */
+struct timeval xferwall;  /* when the run started */
+
+/* checkpoints: a snapshot of the whole simulation taken at one time */
+float checkpointtime;     /* take the snapshot before events after this */
+char checkpointfile[256]; /* where to write it, "" for no checkpoint */
+char restorefile[256];    /* snapshot to continue from, "" to start at 0 */
+
+/* decision log: every random draw the channel and the layer 3 arrival   */
+/* process make, kept as two streams so that a protocol variant that     */
+/* sends a different number of frames still sees the same arrivals       */
+#define LOG_OFF 0
+#define LOG_RECORD 1 /* run on rand() and write the draws to logfile */
+#define LOG_REPLAY 2 /* take the draws from logfile, never call rand() */
+
+int logmode;         /* one of LOG_* */
+char logfile[256];
+
+/* parameter sweep: replications of every point of a grid of parameters */
+char sweepgrid[256]; /* grid file, "" for a single run */
+char sweepcsv[256];  /* where the merged metrics go */
+
 
 void init();
+void init_state(void);
+void flow_sent(int id, int onair);
+void mac_send(int id);
+void mac_resolve(void);
+void mac_init(void);
+void mac_arrival(void);
+void mac_report(void);
+double mac_carried(void);
+double mac_attempted(void);
+void simulate(void);
 void generate_next_arrival(void);
 void insertevent(struct event *p);
+int layer3_offer(int AorB);
+void layer3_retry(void);
+void traffic_init(void);
+void traffic_arrival(int AorB);
+void traffic_refill(void);
+void traffic_report(void);
+void channel_init(void);
+void frame_undetected(struct frm *frame, struct frm *sent);
+void undetected_flush(void);
+void link_init(void);
+void link_sample(void);
+void link_report(void);
+void trace_off(void);
+void trace_on(void);
+void xfer_open(void);
+void xfer_start(void);
+void xfer_take(char data[4]);
+void xfer_write(char data[4]);
+void xfer_finish(void);
+void pipeline_start(void);
+void pipeline_stop(void);
+void pipeline_report(void);
+void flow_init(void);
+void flow_input(int AorB, struct frm frame);
+void flow_tick(void);
+void flow_tx(void);
+int flow_bytes(int id);
+void flow_report(void);
+double flow_fairness(void);
+void checkpoint_save(char *file);
+void checkpoint_params(char *file);
+void checkpoint_restore(char *file);
+void log_open(void);
+void log_close(void);
+int sweep_load(char *file);
+void sweep_run(void);
+void sendq_report(void);
+float arrivalrand(void);
+float channelrand(void);
+int channel_flipbuf(uint8_t *buf, long nbytes);
+int frm_nbytes(void);
+void framing_input(struct event *ev);
+void framing_report(void);
 
 #define WRITE_DOC 1
 
@@ -576,23 +1225,46 @@ void printbinchar(char c)
 }
 
 int main()
+{
+    init();
+    if (sweepgrid[0] != '\0')
+        sweep_run();
+    else
+        simulate();
+
+    if (WRITE_DOC == 1) fclose(fp);
+}
+
+/* run the initialized simulator until the event list or layer 3 runs out */
+void simulate(void)
 {
     struct event *eventptr;
-    struct pkt pkt2give;
     struct frm frm2give;
 
-    int i, j;
-    char c;
+    int i;
 
-    init();
     A_init();
     B_init();
+    if (restorefile[0] != '\0')
+        checkpoint_restore(restorefile);
+#if PROFILE
+    prof_start();
+#endif
+    if (pipeline)
+        pipeline_start();
+    if (xferfile[0] != '\0')
+        xfer_start();
 
     while (1)
     {
         eventptr = evlist; /* get next event to simulate */
         if (eventptr == NULL)
             goto terminate;
+        if (checkpointfile[0] != '\0' && eventptr->evtime > checkpointtime)
+        {
+            checkpoint_save(checkpointfile);
+            checkpointfile[0] = '\0';
+        }
         evlist = evlist->next; /* remove this event from event list */
         if (evlist != NULL)
             evlist->prev = NULL;
@@ -604,36 +1276,37 @@ int main()
                 printf(", timerinterrupt  ");
             else if (eventptr->evtype == 1)
                 printf(", fromlayer3 ");
+            else if (eventptr->evtype == LINK_SAMPLE)
+                printf(", linksample ");
+            else if (eventptr->evtype == FLOW_TIMER)
+                printf(", flowtimer ");
+            else if (eventptr->evtype == FLOW_TX)
+                printf(", flowtx ");
+            else if (eventptr->evtype == MAC_ARRIVAL)
+                printf(", macarrival ");
             else
                 printf(", fromlayer1 ");
             printf(" entity: %d\n", eventptr->eventity);
         }
         time = eventptr->evtime; /* update time to next event time */
+        PROF_BEGIN(dispatch);
         if (eventptr->evtype == FROM_LAYER3)
         {
-            if (nsim < nsimmax)
+            if (nsim < nsimmax && traffic)
+            {
+                traffic_arrival(eventptr->eventity);
+            }
+            else if (nsim < nsimmax)
             {
                 if (nsim + 1 < nsimmax)
                     generate_next_arrival(); /* set up future arrival */
-                /* fill in pkt to give with string of same letter */
-                j = nsim % 26;
-                for (i = 0; i < 4; i++)
-                    pkt2give.data[i] = 97 + j;
-                pkt2give.data[4 - 1] = 0;
-                if (TRACE > 2)
-                {
-                    printf("          MAINLOOP: data given to student: ");
-                    for (i = 0; i < 4; i++)
-                        printf("%c", pkt2give.data[i]);
-                    printf("\n");
-                }
-                nsim++;
-                if (eventptr->eventity == A)
-                    A_output(pkt2give);
-                else
-                    B_output(pkt2give);
+                layer3_offer(eventptr->eventity);
             }
         }
+        else if (eventptr->evtype == FROM_LAYER1 && eventptr->wire != NULL)
+        {
+            framing_input(eventptr);
+        }
         else if (eventptr->evtype == FROM_LAYER1)
         {
             frm2give.type = eventptr->frmptr->type;
@@ -642,10 +1315,19 @@ int main()
             frm2give.checksum = eventptr->frmptr->checksum;
             for (i = 0; i < 4; i++)
                 frm2give.payload[i] = eventptr->frmptr->payload[i];
-            if (eventptr->eventity == A) /* deliver frame by calling */
+            memcpy(frm2give.parity, eventptr->frmptr->parity, FECMAX);
+            frm2give.connid = eventptr->frmptr->connid;
+            if (nflows > 0)
+                flow_input(eventptr->eventity, frm2give);
+            else if (eventptr->eventity == A) /* deliver frame by calling */
                 A_input(frm2give); /* appropriate entity */
             else
                 B_input(frm2give);
+            if (eventptr->corrupted)
+            {
+                frame_undetected(&frm2give, eventptr->origptr);
+                free(eventptr->origptr);
+            }
             free(eventptr->frmptr); /* free the memory for frame */
         }
         else if (eventptr->evtype == TIMER_INTERRUPT)
@@ -655,26 +1337,87 @@ int main()
             else
                 B_timerinterrupt();
         }
+        else if (eventptr->evtype == LINK_SAMPLE)
+        {
+            link_sample();
+        }
+        else if (eventptr->evtype == FLOW_TIMER)
+        {
+            flow_tick();
+        }
+        else if (eventptr->evtype == FLOW_TX)
+        {
+            flow_tx();
+        }
+        else if (eventptr->evtype == MAC_ARRIVAL)
+        {
+            mac_arrival();
+        }
         else
         {
             printf("INTERNAL PANIC: unknown event type \n");
         }
+        PROF_END(dispatch, eventptr->evtype);
+        if (held[A] || held[B])
+            layer3_retry();
+        if (traffic)
+            traffic_refill(); /* saturating sources take any room freed */
         free(eventptr);
     }
 
 terminate:
+    if (pipeline)
+        pipeline_stop();
+    if (xferfile[0] != '\0')
+        trace_on();
+    undetected_flush();
     printf(
         " Simulator terminated at time %f\n after sending %d pkts from layer3\n",
-        time, nsim);
+        time, nsim - held[A] - held[B]);
+    if (lossmodel != LOSS_BERNOULLI || corruptmodel != CORRUPT_FIELD) {
+        printf(" Frames sent into layer1: %d, lost: %d, corrupted: %d\n",
+               ntolayer1, nlost, ncorrupt);
+        printf(" Bits flipped: %d, corrupted frames undetected by CRC: %d\n",
+               nbitflips, nundetected);
+    }
+    if (linkmodel)
+        link_report();
+    if (framing)
+        framing_report();
+    if (fecmode)
+        printf(" Frames repaired by FEC: %d, beyond repair: %d, retransmitted: %d\n",
+               nfecrepaired, nfecfailed, nretransmit);
 
-    if (WRITE_DOC == 1) fclose(fp);
+    if (fastretransmit)
+        printf(" Retransmits: %d on timeout, %d fast, %d NACKs suppressed\n"
+               " Frames recovered: %d, mean time from first send to ACK %f\n",
+               nretransmit, nfastretransmit, nfastsuppressed, nrecovered,
+               nrecovered ? recoverytime / nrecovered : 0);
+    if (sendqdepth > 0)
+        sendq_report();
+    if (traffic)
+        traffic_report();
+    if (nflows > 0)
+        flow_report();
+    if (macmode)
+        mac_report();
+    if (pipeline)
+        pipeline_report();
+    if (xferfile[0] != '\0')
+        xfer_finish();
+    if (logmode != LOG_OFF)
+        log_close();
+
+    while (wait(NULL) > 0) /* checkpoint writers still running */
+        ;
+#if PROFILE
+    prof_report();
+#endif
 }
 
 void init() /* initialize the simulator */
 {
     int i;
-    float sum, avg;
-    float jimsrand();
     char *gen = (char*) malloc (8 * sizeof(char));
 
     printf("-----  Stop and Wait Network Simulator Version 1.1 -------- \n\n");
@@ -696,11 +1439,61 @@ void init() /* initialize the simulator */
     // printf("Enter generator polynomial (in binary and less than 9 bits):");
     // scanf("%s",gen);
 
-    int casechoice;
-    printf("Enter case (1, 2, or 3):");
+    int casechoice, reportcase;
+    printf("Enter case (1 to 23):");
     scanf("%d", &casechoice);
 
-    if (casechoice == 1) {
+    reportcase = casechoice;
+    if (casechoice == 11) {
+        printf("Enter case to checkpoint:");
+        scanf("%d", &casechoice);
+        printf("Enter checkpoint time:");
+        scanf("%f", &checkpointtime);
+        printf("Enter checkpoint file:");
+        scanf("%255s", checkpointfile);
+    } else if (casechoice == 12) {
+        printf("Enter checkpoint file to restore:");
+        scanf("%255s", restorefile);
+    } else if (casechoice == 17) {
+        printf("Enter sweep grid file:");
+        scanf("%255s", sweepgrid);
+        printf("Enter sweep results file (CSV):");
+        scanf("%255s", sweepcsv);
+        casechoice = sweep_load(sweepgrid);
+    } else if (casechoice == 13 || casechoice == 14) {
+        logmode = casechoice == 13 ? LOG_RECORD : LOG_REPLAY;
+        printf(logmode == LOG_RECORD ? "Enter case to record:"
+                                     : "Enter case to replay:");
+        scanf("%d", &casechoice);
+        printf("Enter decision log file:");
+        scanf("%255s", logfile);
+    }
+
+    lossmodel    = LOSS_BERNOULLI;
+    corruptmodel = CORRUPT_FIELD;
+    linkmodel    = 0;
+    fecmode      = FEC_NONE;
+    sendqdepth   = 0;
+    traffic      = 0;
+    fastretransmit = 0;
+    fastholdoff    = 2;
+    fastmax        = 3;
+    pipeline       = 0;
+    framing        = 0;
+    nflows         = 0;
+    flowsizes      = 1;
+    flowsched      = SCHED_DRR;
+    flowtimeout    = 300;
+    wheeltick      = 1;
+    macmode        = MAC_NONE;
+    macframe       = 16;
+    macload        = 0.5;
+    macretry       = 0.05;
+
+    if (restorefile[0] != '\0') {
+            checkpoint_params(restorefile);
+            free(gen); gen = NULL;
+    } else if (casechoice == 1) {
             nsimmax        = 5;
             lossprob       = 0.2;
             corruptprob    = 0.2;
@@ -727,217 +1520,2964 @@ void init() /* initialize the simulator */
             showcrcsteps   = 1;
             piggybacking   = 0;
             free(gen); gen = "11101";
-    } else {
-            nsimmax        = 3;
-            lossprob       = 0.2;
-            corruptprob    = 0.2;
-            lambda         = 10000;
+    } else if (casechoice == 4) {
+            nsimmax        = 50;
+            lossprob       = 0.1;
+            corruptprob    = 0.0;
+            lambda         = 500;
             TRACE          = 1;
             showcrcsteps   = 0;
             piggybacking   = 0;
+            corruptmodel   = CORRUPT_BER;
+            ber            = 0.01;
             free(gen); gen = "11101";
-    }
-
-    int len = strlen(gen);
-    if (len > 8) { printf("ERROR: Generator entered more than 8 bits.\n"); return; }
-    generator = 0;
-    for (int i = 0; i < len; i++) {
-        int x = len - 1 - i;
-        generator += (gen[x] - '0' )* (int) pow(2, i);
-    }
-
-    if (WRITE_DOC == 1) {
-        if (casechoice == 1) fp = freopen("report1.docx", "w+", stdout);
-        else if (casechoice == 2) fp = freopen("report2.docx", "w+", stdout);
-        else if (casechoice == 3) fp = freopen("report3.docx", "w+", stdout);
-        else fp = freopen("report.docx", "w+", stdout);
-    }
-
-    printf("The number of packets to simulate: %d\n", nsimmax);
-    printf("Frame loss probability: %f\n", lossprob);
-    printf("Frame corruption probability: %f\n", corruptprob);
-    printf("Average time between packets from sender's layer3: %f\n", lambda);
-    printf("TRACE: %d\n", TRACE);
-    printf("CRC steps: %d\n", showcrcsteps);
-    printf("Piggybacking: %d\n", piggybacking);
-    printf("Generator polynomial: ");
-    printgenerator();
-    printf("\n\n");
-
-    // return;
-
-    srand(9999); /* init random number generator */
-    sum = 0.0;   /* test random number generator for students */
-    for (i = 0; i < 1000; i++)
-        sum = sum + jimsrand(); /* jimsrand() should be uniform in [0,1] */
-    avg = sum / 1000.0;
-    if (avg < 0.25 || avg > 0.75)
-    {
-        printf("It is likely that random number generation on your machine\n");
-        printf("is different from what this emulator expects.  Please take\n");
-        printf("a look at the routine jimsrand() in the emulator code. Sorry. \n");
-        exit(1);
-    }
-
+    } else if (casechoice == 5) {
+            nsimmax        = 50;
+            lossprob       = 0.0;
+            corruptprob    = 0.1;
+            lambda         = 500;
+            TRACE          = 1;
+            showcrcsteps   = 0;
+            piggybacking   = 0;
+            lossmodel      = LOSS_GILBERT;
+            gegood2bad     = 0.05;
+            gebad2good     = 0.3;
+            gelossgood     = 0.0;
+            gelossbad      = 0.8;
+            free(gen); gen = "11101";
+    } else if (casechoice == 6) {
+            nsimmax        = 20;
+            lossprob       = 0.0;
+            corruptprob    = 0.0;
+            lambda         = 500;
+            TRACE          = 1;
+            showcrcsteps   = 0;
+            piggybacking   = 0;
+            corruptmodel   = CORRUPT_BER;
+            ber            = 0.005;
+            lossmodel      = LOSS_TRACE;
+            printf("Enter loss trace file:");
+            scanf("%255s", losstrace);
+            free(gen); gen = "11101";
+    } else if (casechoice == 7 || casechoice == 8) {
+            nsimmax        = 50;
+            lossprob       = 0.05;
+            corruptprob    = 0.05;
+            lambda         = 20;
+            TRACE          = 1;
+            showcrcsteps   = 0;
+            piggybacking   = 0;
+            linkmodel      = 1;
+            bandwidth      = 0.2;
+            propdelay      = 10;
+            jitter         = 2;
+            qlimit         = 1;
+            qdiscipline    = QUEUE_TAILDROP;
+            statinterval   = 200;
+            if (casechoice == 8) {
+                qlimit       = 4;
+                qdiscipline  = QUEUE_RED;
+                redminth     = 0.2;
+                redmaxth     = 1.5;
+                redmaxp      = 0.2;
+                redweight    = 0.25;
+            }
+            free(gen); gen = "11101";
+    } else if (casechoice == 9) {
+            nsimmax        = 20;
+            lossprob       = 0.0;
+            corruptprob    = 0.5;
+            lambda         = 500;
+            TRACE          = 1;
+            showcrcsteps   = 0;
+            piggybacking   = 0;
+            fecmode        = FEC_RS;
+            rsparity       = 2;
+            free(gen); gen = "11101";
+    } else if (casechoice == 10) {
+            nsimmax        = 50;
+            lossprob       = 0.0;
+            corruptprob    = 0.0;
+            lambda         = 500;
+            TRACE          = 1;
+            showcrcsteps   = 0;
+            piggybacking   = 0;
+            corruptmodel   = CORRUPT_BER;
+            ber            = 0.01;
+            fecmode        = FEC_SECDED;
+            free(gen); gen = "11101";
+    } else if (casechoice == 15) {
+            nsimmax        = 50;
+            lossprob       = 0.1;
+            corruptprob    = 0.1;
+            lambda         = 30;
+            TRACE          = 1;
+            showcrcsteps   = 0;
+            piggybacking   = 0;
+            sendqdepth     = 8;
+            free(gen); gen = "11101";
+    } else if (casechoice == 16) {
+            nsimmax        = 100;
+            lossprob       = 0.1;
+            corruptprob    = 0.1;
+            lambda         = 0;
+            TRACE          = 1;
+            showcrcsteps   = 0;
+            piggybacking   = 0;
+            sendqdepth     = 4;
+            traffic        = 1;
+            for (int k = A; k <= B; k++) {
+                struct source *src = &sources[k];
+                char c = k == A ? 'A' : 'B';
+                src->type    = SRC_POISSON;
+                src->rate    = 0.02;
+                src->onmean  = 100;
+                src->offmean = 400;
+                if (sweepgrid[0] != '\0') /* a grid sets rates on its axes */
+                    continue;
+                printf("Enter traffic source at %c (0 none, 1 Poisson, 2 on/off, "
+                       "3 CBR, 4 trace, 5 saturating):", c);
+                scanf("%d", &src->type);
+                if (src->type < SRC_NONE || src->type > SRC_SATURATE) {
+                    printf("ERROR: traffic source must be 0 to 5\n");
+                    exit(1);
+                }
+                if (src->type == SRC_POISSON || src->type == SRC_ONOFF ||
+                    src->type == SRC_CBR) {
+                    printf(src->type == SRC_ONOFF
+                           ? "Enter peak rate at %c (packets per unit):"
+                           : "Enter rate at %c (packets per unit):", c);
+                    scanf("%f", &src->rate);
+                    if (!(src->rate > 0)) {
+                        printf("ERROR: rate must be positive\n");
+                        exit(1);
+                    }
+                }
+                if (src->type == SRC_ONOFF) {
+                    printf("Enter mean on and off periods at %c:", c);
+                    scanf("%f %f", &src->onmean, &src->offmean);
+                    if (!(src->onmean > 0) || !(src->offmean > 0)) {
+                        printf("ERROR: on and off periods must be positive\n");
+                        exit(1);
+                    }
+                }
+                if (src->type == SRC_TRACE) {
+                    printf("Enter arrival trace file for %c:", c);
+                    scanf("%255s", src->tracefile);
+                }
+            }
+            free(gen); gen = "11101";
+    } else if (casechoice == 18) {
+            nsimmax        = 50;
+            lossprob       = 0.1;
+            corruptprob    = 0.3;
+            lambda         = 500;
+            TRACE          = 1;
+            showcrcsteps   = 0;
+            piggybacking   = 0;
+            fastretransmit = 1;
+            free(gen); gen = "11101";
+    } else if (casechoice == 19) {
+            nsimmax        = 5000;
+            lossprob       = 0.01;
+            corruptprob    = 0.01;
+            lambda         = 0;
+            TRACE          = 0;
+            showcrcsteps   = 0;
+            piggybacking   = 0;
+            linkmodel      = 1;
+            bandwidth      = 1;
+            propdelay      = 10;
+            jitter         = 0;
+            qlimit         = 1;
+            qdiscipline    = QUEUE_TAILDROP;
+            statinterval   = 0;
+            printf("Enter number of flows:");
+            scanf("%d", &nflows);
+            printf("Enter flow scheduler (0 FIFO, 1 DRR):");
+            scanf("%d", &flowsched);
+            flowsizes      = 3;
+            free(gen); gen = "11101";
+    } else if (casechoice == 20) {
+            nsimmax        = 200000;
+            lossprob       = 0.01;
+            corruptprob    = 0.01;
+            lambda         = 0;
+            TRACE          = 0;
+            showcrcsteps   = 0;
+            piggybacking   = 0;
+            sendqdepth     = 8;
+            traffic        = 1;
+            sources[A].type = sources[B].type = SRC_SATURATE;
+            pipeline       = 1;
+            free(gen); gen = "11101";
+    } else if (casechoice == 21) {
+            lossprob       = 0.01;
+            corruptprob    = 0.01;
+            lambda         = 0;
+            TRACE          = 0;
+            showcrcsteps   = 0;
+            piggybacking   = 0;
+            sendqdepth     = 8;
+            traffic        = 1;
+            sources[A].type = SRC_SATURATE;
+            sources[B].type = SRC_NONE;
+            printf("Enter file to send:");
+            scanf("%255s", xferfile);
+            printf("Enter file to receive into:");
+            scanf("%255s", xferout);
+            xfer_open(); /* nsimmax is the number of 4 byte packets */
+            free(gen); gen = "11101";
+    } else if (casechoice == 23) {
+            nsimmax        = 20000;
+            lossprob       = 0.0;
+            corruptprob    = 0.0;
+            lambda         = 0;
+            TRACE          = 0;
+            showcrcsteps   = 0;
+            piggybacking   = 0;
+            flowsizes      = 1;
+            flowsched      = SCHED_FIFO;
+            macmode        = MAC_ALOHA;
+            nflows         = 10;
+            if (sweepgrid[0] == '\0') { /* a grid sets these on its axes */
+                printf("Enter MAC (1 slotted ALOHA, 2 CSMA/CD, 3 token passing):");
+                scanf("%d", &macmode);
+                printf("Enter number of stations:");
+                scanf("%d", &nflows);
+                printf("Enter offered load (frames per frame time):");
+                scanf("%f", &macload);
+            }
+            if (macmode < MAC_ALOHA || macmode > MAC_TOKEN) {
+                printf("ERROR: MAC must be 1, 2 or 3\n");
+                exit(1);
+            }
+            if (nflows < 1) {
+                printf("ERROR: at least one station is needed\n");
+                exit(1);
+            }
+            free(gen); gen = "11101";
+    } else if (casechoice == 22) {
+            nsimmax        = 2000;
+            lossprob       = 0.05;
+            corruptprob    = 0.0;
+            lambda         = 100;
+            TRACE          = 0;
+            showcrcsteps   = 0;
+            piggybacking   = 0;
+            corruptmodel   = CORRUPT_BER;
+            ber            = 0.002;
+            framing        = 1;
+            free(gen); gen = "11101";
+    } else {
+            nsimmax        = 3;
+            lossprob       = 0.2;
+            corruptprob    = 0.2;
+            lambda         = 10000;
+            TRACE          = 1;
+            showcrcsteps   = 0;
+            piggybacking   = 0;
+            free(gen); gen = "11101";
+    }
+
+    if (sendqdepth > SENDQMAX) sendqdepth = SENDQMAX;
+    if (nflows > MAXFLOWS) {
+        printf("ERROR: at most %d flows\n", MAXFLOWS);
+        exit(1);
+    }
+
+    int len = gen != NULL ? strlen(gen) : 0;
+    if (len > 8) { printf("ERROR: Generator entered more than 8 bits.\n"); return; }
+    if (gen != NULL) generator = 0;
+    for (int i = 0; i < len; i++) {
+        int x = len - 1 - i;
+        generator += (gen[x] - '0' )* (int) pow(2, i);
+    }
+
+    if (WRITE_DOC == 1) {
+        char report[32];
+        if (reportcase >= 1 && reportcase <= 23)
+            sprintf(report, "report%d.docx", reportcase);
+        else
+            strcpy(report, "report.docx");
+        fp = freopen(report, "w+", stdout);
+    }
+
+    printf("The number of packets to simulate: %d\n", nsimmax);
+    printf("Frame loss probability: %f\n", lossprob);
+    printf("Frame corruption probability: %f\n", corruptprob);
+    printf("Average time between packets from sender's layer3: %f\n", lambda);
+    printf("TRACE: %d\n", TRACE);
+    printf("CRC steps: %d\n", showcrcsteps);
+    printf("Piggybacking: %d\n", piggybacking);
+    printf("Generator polynomial: ");
+    printgenerator();
+    if (lossmodel == LOSS_GILBERT)
+        printf("Gilbert-Elliott loss: p(G->B) %f, p(B->G) %f, loss %f/%f\n",
+               gegood2bad, gebad2good, gelossgood, gelossbad);
+    if (lossmodel == LOSS_TRACE)
+        printf("Loss trace: %s\n", losstrace);
+    if (corruptmodel == CORRUPT_BER)
+        printf("Bit error rate: %g\n", ber);
+    if (framing)
+        printf("Framing: flag 0x%02x, escape 0x%02x, byte stuffing\n", FLAG,
+               ESCAPE);
+    if (linkmodel) {
+        printf("Link: %f bytes/unit, propagation %f, jitter %f\n",
+               bandwidth, propdelay, jitter);
+        printf("Transmit queue: %d frames, %s\n", qlimit,
+               qdiscipline == QUEUE_RED ? "RED" : "tail drop");
+    }
+    if (fecmode == FEC_SECDED)
+        printf("FEC: SECDED (%d,%d)\n", 8 * frm_hdrbytes() + 8,
+               8 * frm_hdrbytes());
+    if (fecmode == FEC_RS)
+        printf("FEC: Reed-Solomon, %d check bytes\n", rsparity);
+    if (sendqdepth > 0)
+        printf("Send queue depth: %d\n", sendqdepth);
+    if (fastretransmit)
+        printf("Fast retransmit: holdoff %f, at most %d per frame\n",
+               fastholdoff, fastmax);
+    if (pipeline)
+        printf("Layer 3: application threads, rings of %d packets\n", APPRING);
+    if (xferfile[0] != '\0')
+        printf("File transfer: %s (%zu bytes) to %s\n", xferfile, xfersize,
+               xferout);
+    if (nflows > 0)
+        printf("Flows: %d, %d frame sizes, %s, timeout %f, timer tick %f\n",
+               nflows, flowsizes, flowsched == SCHED_DRR ? "DRR" : "FIFO",
+               flowtimeout, wheeltick);
+    if (macmode)
+        printf("Shared medium: %s, frames of %d slots, offered load %f\n",
+               macnames[macmode], macframe, macload);
+    for (i = A; traffic && i <= B; i++) {
+        static const char *names[] = { "none", "Poisson", "on/off", "CBR",
+                                       "trace", "saturating" };
+        printf("Traffic at %c: %s", i == A ? 'A' : 'B', names[sources[i].type]);
+        if (sources[i].type == SRC_POISSON || sources[i].type == SRC_CBR)
+            printf(", %f packets/unit", sources[i].rate);
+        if (sources[i].type == SRC_ONOFF)
+            printf(", %f packets/unit, on %f, off %f", sources[i].rate,
+                   sources[i].onmean, sources[i].offmean);
+        if (sources[i].type == SRC_TRACE)
+            printf(", %s", sources[i].tracefile);
+        printf("\n");
+    }
+    if (logmode == LOG_RECORD)
+        printf("Recording decisions to: %s\n", logfile);
+    if (logmode == LOG_REPLAY)
+        printf("Replaying decisions from: %s\n", logfile);
+    if (sweepgrid[0] != '\0')
+        printf("Sweep grid: %s\n", sweepgrid);
+    printf("\n\n");
+
+    if (restorefile[0] != '\0')
+        return; /* checkpoint_restore() brings back the rest */
+    if (sweepgrid[0] != '\0')
+        return; /* every replication starts its own run in sweep_job() */
+
+    init_state();
+}
+
+/* seed the generators and empty the counters and the event list */
+void init_state(void)
+{
+    int i;
+    float sum, avg;
+    float jimsrand();
+
+    if (logmode != LOG_OFF)
+        log_open();
+
+    if (logmode != LOG_REPLAY)
+    {
+        srand(seed); /* init random number generator */
+        nrand = 0;
+        sum = 0.0;   /* test random number generator for students */
+        for (i = 0; i < 1000; i++)
+            sum = sum + jimsrand(); /* jimsrand() should be uniform in [0,1] */
+        avg = sum / 1000.0;
+        if (avg < 0.25 || avg > 0.75)
+        {
+            printf("It is likely that random number generation on your machine\n");
+            printf("is different from what this emulator expects.  Please take\n");
+            printf("a look at the routine jimsrand() in the emulator code. Sorry. \n");
+            exit(1);
+        }
+    }
+
     ntolayer1 = 0;
     nlost = 0;
     ncorrupt = 0;
+    nbitflips = 0;
+    nundetected = 0;
+    nundetframes = 0;
+    nwirebytes = 0;
+    nescaped = 0;
+    nbadlength = 0;
+    nqdrop = 0;
+    nblocked = 0;
+    nfecrepaired = 0;
+    nfecfailed = 0;
+    nretransmit = 0;
+    nfastretransmit = 0;
+    nfastsuppressed = 0;
+    nrecovered = 0;
+    recoverytime = 0;
+    channel_init();
+    if (fecmode)
+        fec_init();
+    for (i = A; framing && i <= B; i++)
+    {
+        deframer_free(&deframers[i]);
+        if (!deframer_init(&deframers[i], 2 * frm_nbytes()))
+        {
+            printf("ERROR: out of memory for the deframers\n");
+            exit(1);
+        }
+    }
+
+    ndelivered[A] = ndelivered[B] = 0;
+    held[A] = held[B] = 0;
+    xferread = xferwritten = 0;
+
+    time = 0.0;              /* initialize time to 0.0 */
+    if (nflows > 0)
+        ; /* the flows pull their packets from layer 3 themselves */
+    else if (traffic)
+        traffic_init();
+    else
+        generate_next_arrival(); /* initialize event list */
+    if (linkmodel)
+        link_init();
+    if (nflows > 0)
+        flow_init();
+}
+
+/****************************************************************************/
+/* jimsrand(): return a float in range [0,1].  The routine below is used to */
+/* isolate all random number generation in one location.  We assume that the*/
+/* system-supplied rand() function return an int in therange [0,mmm]        */
+/****************************************************************************/
+float jimsrand(void)
+{
+    double mmm = RAND_MAX;
+    float x;                 /* individual students may need to change mmm */
+    nrand++;
+    x = rand() / mmm;        /* x should be uniform in [0,1] */
+    return (x);
+}
+
+/************************ DECISION LOG ****************/
+/* The log is a header followed by the arrival draws and then the       */
+/* channel draws, each an array of floats.  Recording keeps the draws in */
+/* memory and writes the file at the end of the run; replay maps the     */
+/* file and walks both arrays, wrapping around if a variant needs more.  */
+
+#define LOGMAGIC 0x474c4c44 /* "DLLG" */
+
+struct logheader
+{
+    int magic;
+    int version;
+    long narrival; /* draws in the arrival stream */
+    long nchannel; /* draws in the channel stream */
+};
+
+struct logstream
+{
+    float *draws;
+    long len;      /* draws recorded, or available to replay */
+    long pos;      /* next draw to replay */
+    long cap;      /* room in draws while recording */
+    int wrapped;   /* replay ran past the end at least once */
+} arrivallog, channellog;
+
+void *logmap;      /* the mapped file while replaying */
+size_t logmaplen;
+
+void log_open(void)
+{
+    struct logheader *h;
+    struct stat st;
+    int fd;
+
+    memset(&arrivallog, 0, sizeof(arrivallog));
+    memset(&channellog, 0, sizeof(channellog));
+    if (logmode == LOG_RECORD)
+        return;
+
+    if ((fd = open(logfile, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+    {
+        printf("ERROR: cannot open decision log %s\n", logfile);
+        exit(1);
+    }
+    logmaplen = st.st_size;
+    logmap = mmap(NULL, logmaplen, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    h = logmap;
+    if (logmap == MAP_FAILED || logmaplen < sizeof(*h) || h->magic != LOGMAGIC
+        || h->narrival <= 0 || h->nchannel <= 0
+        || logmaplen != sizeof(*h) + (h->narrival + h->nchannel) * sizeof(float))
+    {
+        printf("ERROR: %s is not a usable decision log\n", logfile);
+        exit(1);
+    }
+    posix_madvise(logmap, logmaplen, POSIX_MADV_SEQUENTIAL);
+    arrivallog.draws = (float *)(h + 1);
+    arrivallog.len = h->narrival;
+    channellog.draws = arrivallog.draws + h->narrival;
+    channellog.len = h->nchannel;
+}
+
+void log_close(void)
+{
+    struct logheader h;
+    FILE *f;
+
+    if (logmode == LOG_REPLAY)
+    {
+        printf(" Replayed %ld arrival and %ld channel decisions from %s\n",
+               arrivallog.pos, channellog.pos, logfile);
+        if (arrivallog.wrapped || channellog.wrapped)
+            printf(" Warning: the log ran out and was reused from the start\n");
+        munmap(logmap, logmaplen);
+        return;
+    }
+
+    h.magic = LOGMAGIC;
+    h.version = 1;
+    h.narrival = arrivallog.len;
+    h.nchannel = channellog.len;
+    if ((f = fopen(logfile, "wb")) == NULL)
+    {
+        printf("ERROR: cannot write decision log %s\n", logfile);
+        return;
+    }
+    fwrite(&h, sizeof(h), 1, f);
+    fwrite(arrivallog.draws, sizeof(float), arrivallog.len, f);
+    fwrite(channellog.draws, sizeof(float), channellog.len, f);
+    fclose(f);
+    printf(" Recorded %ld arrival and %ld channel decisions to %s\n",
+           arrivallog.len, channellog.len, logfile);
+    free(arrivallog.draws);
+    free(channellog.draws);
+}
+
+/* the next draw of a stream: from rand(), recorded or not, or replayed */
+float lograndom(struct logstream *l)
+{
+    float x;
+
+    if (logmode == LOG_REPLAY)
+    {
+        if (l->pos == l->len)
+        {
+            l->pos = 0;
+            l->wrapped = 1;
+        }
+        return l->draws[l->pos++];
+    }
+
+    x = jimsrand();
+    if (logmode == LOG_RECORD)
+    {
+        if (l->len == l->cap)
+        {
+            l->cap = l->cap ? 2 * l->cap : 4096;
+            l->draws = realloc(l->draws, l->cap * sizeof(float));
+        }
+        l->draws[l->len++] = x;
+    }
+    return x;
+}
+
+/* draws for layer 3 arrivals */
+float arrivalrand(void)
+{
+    return lograndom(&arrivallog);
+}
+
+/* draws for losses, delays and corruption in the medium */
+float channelrand(void)
+{
+    return lograndom(&channellog);
+}
+
+/********************* EVENT HANDLINE ROUTINES *******/
+/*  The next set of routines handle the event list   */
+/*****************************************************/
+
+void generate_next_arrival(void)
+{
+    double x, log(), ceil();
+    struct event *evptr;
+    float ttime;
+    int tempint;
+
+    if (TRACE > 2)
+        printf("          GENERATE NEXT ARRIVAL: creating new arrival\n");
+
+    x = lambda * arrivalrand() * 2; /* x is uniform on [0,2*lambda] */
+    /* having mean of lambda        */
+    evptr = (struct event *)malloc(sizeof(struct event));
+    evptr->evtime = time + x;
+    evptr->evtype = FROM_LAYER3;
+    if (BIDIRECTIONAL && (arrivalrand() > 0.5))
+        evptr->eventity = B;
+    else
+        evptr->eventity = A;
+    insertevent(evptr);
+}
+
+/* hand layer 2 at AorB the next packet, a string of the same letter */
+/* or the application's next one; returns whether it was accepted.   */
+/* With a send queue, a refused packet is held and offered again     */
+/* before any new one; without, it is dropped as stop-and-wait does.  */
+int layer3_offer(int AorB)
+{
+    struct pkt pkt2give;
+    int i, j, accepted, again = held[AorB];
+
+    if (again) /* refused last time: offer it again */
+    {
+        pkt2give = heldpkt[AorB];
+        held[AorB] = 0;
+    }
+    else if (pipeline)
+        app_take(AorB, pkt2give.data);
+    else if (xferfile[0] != '\0')
+        xfer_take(pkt2give.data);
+    else
+    {
+        /* fill in pkt to give with string of same letter */
+        j = nsim % 26;
+        for (i = 0; i < 4; i++)
+            pkt2give.data[i] = 97 + j;
+        pkt2give.data[4 - 1] = 0;
+        if (framing) /* give the stuffer a flag or an escape to escape */
+            pkt2give.data[nsim % 3] = nsim % 2 ? FLAG : ESCAPE;
+    }
+    if (TRACE > 2)
+    {
+        printf("          MAINLOOP: data given to student: ");
+        for (i = 0; i < 4; i++)
+            printf("%c", pkt2give.data[i]);
+        printf("\n");
+    }
+    if (!again)
+        nsim++;
+    if (AorB == A)
+        accepted = A_output(pkt2give);
+    else
+        accepted = B_output(pkt2give);
+    if (accepted && xferfile[0] != '\0')
+        xferread += 4;
+    if (!accepted)
+    {
+        nblocked++;
+        if (sendqdepth > 0 || pipeline)
+        {
+            heldpkt[AorB] = pkt2give;
+            held[AorB] = 1;
+        }
+    }
+    return accepted;
+}
+
+/* offer held packets again as soon as layer 2 has room for them */
+void layer3_retry(void)
+{
+    int i;
+
+    for (i = A; i <= B; i++)
+        if (held[i] && entity_can_accept(i))
+            layer3_offer(i);
+}
+
+/********************** TRAFFIC SOURCES **************/
+
+float *tracetimes[2]; /* arrival times of each trace source */
+long tracecount[2];
+
+/* exponential with the given mean */
+float expdraw(float mean)
+{
+    float u = arrivalrand();
+    if (u <= 0)
+        u = 1e-9;
+    return -mean * log(u);
+}
+
+void traffic_load(int AorB)
+{
+    struct source *src = &sources[AorB];
+    FILE *tf;
+    float t;
+
+    if ((tf = fopen(src->tracefile, "r")) == NULL)
+    {
+        printf("ERROR: cannot open arrival trace %s\n", src->tracefile);
+        exit(1);
+    }
+    tracecount[AorB] = 0;
+    while (fscanf(tf, "%f", &t) == 1)
+    {
+        if (tracecount[AorB] % 1024 == 0)
+            tracetimes[AorB] = realloc(tracetimes[AorB],
+                                       (tracecount[AorB] + 1024) * sizeof(float));
+        tracetimes[AorB][tracecount[AorB]++] = t;
+    }
+    fclose(tf);
+}
+
+/* schedule the next arrival from AorB's source, if it has one */
+void traffic_schedule(int AorB)
+{
+    struct source *src = &sources[AorB];
+    struct event *evptr;
+    float t;
+
+    if (src->type == SRC_POISSON)
+        t = time + expdraw(1 / src->rate);
+    else if (src->type == SRC_CBR)
+        t = time + 1 / src->rate;
+    else if (src->type == SRC_ONOFF)
+    {
+        t = time + expdraw(1 / src->rate);
+        while (t > src->onend) /* past this on period: wait out an off one */
+        {
+            t = src->onend + expdraw(src->offmean);
+            src->onend = t + expdraw(src->onmean);
+            t += expdraw(1 / src->rate);
+        }
+    }
+    else if (src->type == SRC_TRACE && src->tracepos < tracecount[AorB])
+        t = tracetimes[AorB][src->tracepos++];
+    else if (src->type == SRC_SATURATE && time == 0)
+        t = 0; /* one event to start; traffic_refill() does the rest */
+    else
+        return;
+
+    if (TRACE > 2)
+        printf("          GENERATE NEXT ARRIVAL: creating new arrival\n");
+    evptr = (struct event *)malloc(sizeof(struct event));
+    evptr->evtime = t < time ? time : t;
+    evptr->evtype = FROM_LAYER3;
+    evptr->eventity = AorB;
+    insertevent(evptr);
+}
+
+void traffic_init(void)
+{
+    int i;
+
+    for (i = A; i <= B; i++)
+    {
+        sources[i].tracepos = 0;
+        if (sources[i].type == SRC_ONOFF)
+            sources[i].onend = expdraw(sources[i].onmean);
+        if (sources[i].type == SRC_TRACE)
+            traffic_load(i);
+        traffic_schedule(i);
+    }
+}
+
+void traffic_arrival(int AorB)
+{
+    if (sources[AorB].type == SRC_SATURATE)
+        return; /* traffic_refill() runs after every event */
+    layer3_offer(AorB);
+    if (nsim < nsimmax)
+        traffic_schedule(AorB);
+}
+
+/* keep saturating sources backlogged: offer packets as long as layer 2 */
+/* can take them, so refusals only come from a full queue              */
+void traffic_refill(void)
+{
+    int i;
+
+    for (i = A; i <= B; i++)
+        while (sources[i].type == SRC_SATURATE && nsim < nsimmax
+               && entity_can_accept(i))
+            layer3_offer(i);
+}
+
+void traffic_report(void)
+{
+    int i;
+
+    for (i = A; i <= B; i++)
+        printf(" Delivered to layer3 at %c: %d packets, %f per unit\n",
+               i == A ? 'A' : 'B', ndelivered[i],
+               time > 0 ? ndelivered[i] / time : 0);
+}
+
+void insertevent(struct event *p)
+{
+    struct event *q, *qold;
+    PROF_BEGIN(insertevent);
+
+    if (TRACE > 2)
+    {
+        printf("            INSERTEVENT: time is %lf\n", time);
+        printf("            INSERTEVENT: future time will be %lf\n", p->evtime);
+    }
+    q = evlist;      /* q points to header of list in which p struct inserted */
+    if (q == NULL)   /* list is empty */
+    {
+        evlist = p;
+        p->next = NULL;
+        p->prev = NULL;
+    }
+    else
+    {
+        for (qold = q; q != NULL && p->evtime > q->evtime; q = q->next)
+            qold = q;
+        if (q == NULL)   /* end of list */
+        {
+            qold->next = p;
+            p->prev = qold;
+            p->next = NULL;
+        }
+        else if (q == evlist)     /* front of list */
+        {
+            p->next = evlist;
+            p->prev = NULL;
+            p->next->prev = p;
+            evlist = p;
+        }
+        else     /* middle of list */
+        {
+            p->next = q;
+            p->prev = q->prev;
+            q->prev->next = p;
+            q->prev = p;
+        }
+    }
+    PROF_END(insertevent, PROF_INSERTEVENT);
+}
+
+void printevlist(void)
+{
+    struct event *q;
+    int i;
+    printf("--------------\nEvent List Follows:\n");
+    for (q = evlist; q != NULL; q = q->next)
+    {
+        printf("Event time: %f, type: %d entity: %d\n", q->evtime, q->evtype,
+               q->eventity);
+    }
+    printf("--------------\n");
+}
+
+/********************** Student-callable ROUTINES ***********************/
+
+/* the current simulated time */
+float gettime(void)
+{
+    return time;
+}
+
+/* called by students routine to cancel a previously-started timer */
+void stoptimer(int AorB /* A or B is trying to stop timer */)
+{
+    struct event *q, *qold;
+    PROF_BEGIN(stoptimer);
+
+    if (TRACE > 2)
+        printf("          STOP TIMER: stopping timer at %f\n", time);
+    /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
+    for (q = evlist; q != NULL; q = q->next)
+        if ((q->evtype == TIMER_INTERRUPT && q->eventity == AorB))
+        {
+            /* remove this event */
+            if (q->next == NULL && q->prev == NULL)
+                evlist = NULL;          /* remove first and only event on list */
+            else if (q->next == NULL) /* end of list - there is one in front */
+                q->prev->next = NULL;
+            else if (q == evlist)   /* front of list - there must be event after */
+            {
+                q->next->prev = NULL;
+                evlist = q->next;
+            }
+            else     /* middle of list */
+            {
+                q->next->prev = q->prev;
+                q->prev->next = q->next;
+            }
+            free(q);
+            PROF_END(stoptimer, PROF_STOPTIMER);
+            return;
+        }
+    printf("Warning: unable to cancel your timer. It wasn't running.\n");
+    PROF_END(stoptimer, PROF_STOPTIMER);
+}
+
+void starttimer(int AorB /* A or B is trying to start timer */, float increment)
+{
+    struct event *q;
+    struct event *evptr;
+    PROF_BEGIN(starttimer);
+
+    if (TRACE > 2)
+        printf("          START TIMER: starting timer at %f\n", time);
+    /* be nice: check to see if timer is already started, if so, then  warn */
+    /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
+    for (q = evlist; q != NULL; q = q->next)
+        if ((q->evtype == TIMER_INTERRUPT && q->eventity == AorB))
+        {
+            printf("Warning: attempt to start a timer that is already started\n");
+            PROF_END(starttimer, PROF_STARTTIMER);
+            return;
+        }
+
+    /* create future event for when timer goes off */
+    evptr = (struct event *)malloc(sizeof(struct event));
+    evptr->evtime = time + increment;
+    evptr->evtype = TIMER_INTERRUPT;
+    evptr->eventity = AorB;
+    insertevent(evptr);
+    PROF_END(starttimer, PROF_STARTTIMER);
+}
+
+/*********************** CHANNEL MODELS ************/
+/* Loss and bit errors are sampled by geometric skip-ahead: instead of   */
+/* one random draw per frame (or per bit), draw how many frames (bits)   */
+/* pass before the next event and count them down.                       */
+
+long bitskip;      /* bits left before the next bit error */
+int gebad;         /* Gilbert-Elliott: in bad state (1) or good (0) */
+long gerun;        /* frames left before the next state change */
+long geskip;       /* frames left before the next loss in this state */
+char *tracebuf;    /* loss trace contents */
+long tracelen;
+long tracepos;
+
+/* number of failures before the first success in Bernoulli(p) trials; */
+/* "never" is LONG_MAX / 2, so callers can still add to it              */
+long geomskip(float p)
+{
+    double u, k;
+
+    if (p <= 0.0)
+        return LONG_MAX / 2;
+    if (p >= 1.0)
+        return 0;
+    u = channelrand(); /* P(k >= n) = P(u <= (1-p)^n) = (1-p)^n */
+    if (u <= 0.0)
+        return LONG_MAX / 2;
+    k = floor(log(u) / log(1.0 - p));
+    return k < LONG_MAX / 2 ? (long)k : LONG_MAX / 2;
+}
+
+/* bytes of a frame before its FEC check bytes: with flows, the header */
+/* carries the connection ID between the type and the checksum          */
+int frm_hdrbytes(void)
+{
+    return FRMBYTES + (nflows > 0 ? CONNIDBYTES : 0);
+}
+
+/* serialize a frame in the byte order the CRC is computed over, */
+/* followed by the FEC check bytes; returns the length             */
+int frm_to_bytes(struct frm *frame, uint8_t *buf)
+{
+    int i, n = frm_hdrbytes();
+    for (i = 0; i < 4; i++)
+        buf[i] = frame->payload[i];
+    buf[4] = frame->seqnum;
+    buf[5] = frame->acknum;
+    buf[6] = frame->type;
+    for (i = 0; i < n - FRMBYTES; i++) /* high byte first, as encode() */
+        buf[7 + i] = frame->connid >> 8 * (CONNIDBYTES - 1 - i);
+    buf[n - 1] = frame->checksum;
+    memcpy(buf + n, frame->parity, fec_nbytes());
+    return n + fec_nbytes();
+}
+
+void frm_from_bytes(uint8_t *buf, struct frm *frame)
+{
+    int i, n = frm_hdrbytes();
+    for (i = 0; i < 4; i++)
+        frame->payload[i] = buf[i];
+    frame->seqnum = buf[4];
+    frame->acknum = buf[5];
+    frame->type = buf[6];
+    for (frame->connid = 0, i = 0; i < n - FRMBYTES; i++)
+        frame->connid = frame->connid << 8 | buf[7 + i];
+    frame->checksum = buf[n - 1];
+    memcpy(frame->parity, buf + n, fec_nbytes());
+}
+
+/* bytes a frame occupies on the wire */
+int frm_nbytes(void)
+{
+    return frm_hdrbytes() + fec_nbytes();
+}
+
+/* the same for a particular frame: data of some flows takes longer */
+int frm_wirebytes(struct frm *frame)
+{
+    if (nflows > 0 && frame->type == DATA)
+        return flow_bytes(frame->connid);
+    return frm_nbytes();
+}
+
+void channel_init(void)
+{
+    FILE *tf;
+    int c;
+
+    if (corruptmodel == CORRUPT_BER)
+        bitskip = geomskip(ber);
+
+    if (lossmodel == LOSS_GILBERT)
+    {
+        gebad = 0;
+        gerun = 1 + geomskip(gegood2bad);
+        geskip = geomskip(gelossgood);
+    }
+
+    if (lossmodel == LOSS_TRACE)
+    {
+        if ((tf = fopen(losstrace, "r")) == NULL)
+        {
+            printf("ERROR: cannot open loss trace %s\n", losstrace);
+            exit(1);
+        }
+        tracelen = 0;
+        tracebuf = NULL;
+        while ((c = fgetc(tf)) != EOF)
+        {
+            if (c != '0' && c != '1')
+                continue;
+            if (tracelen % 4096 == 0)
+                tracebuf = realloc(tracebuf, tracelen + 4096);
+            tracebuf[tracelen++] = c;
+        }
+        fclose(tf);
+        if (tracelen == 0)
+        {
+            printf("ERROR: loss trace %s has no frames\n", losstrace);
+            exit(1);
+        }
+        tracepos = 0;
+    }
+}
+
+/* decide whether the next frame put into the medium is lost */
+int channel_loses(void)
+{
+    int lost;
+
+    if (lossmodel == LOSS_GILBERT)
+    {
+        if (gerun == 0) /* change state, redraw both skips */
+        {
+            gebad = !gebad;
+            gerun = 1 + geomskip(gebad ? gebad2good : gegood2bad);
+            geskip = geomskip(gebad ? gelossbad : gelossgood);
+        }
+        gerun--;
+        if (geskip > 0)
+        {
+            geskip--;
+            return 0;
+        }
+        geskip = geomskip(gebad ? gelossbad : gelossgood);
+        return 1;
+    }
+
+    if (lossmodel == LOSS_TRACE)
+    {
+        lost = tracebuf[tracepos] == '1';
+        tracepos = (tracepos + 1) % tracelen; /* the pattern repeats */
+        return lost;
+    }
+
+    return channelrand() < lossprob;
+}
+
+/* flip the bits of nbytes bytes that the error process hits; */
+/* returns the number of bits flipped */
+int channel_flipbuf(uint8_t *buf, long nbytes)
+{
+    long nbits = nbytes * 8;
+    int flips = 0;
+
+    while (bitskip < nbits)
+    {
+        buf[bitskip / 8] ^= 0x80 >> (bitskip % 8);
+        flips++;
+        bitskip += 1 + geomskip(ber);
+    }
+    bitskip -= nbits;
+    nbitflips += flips;
+    return flips;
+}
+
+/* the same for a frame, serialized only if a bit is hit */
+int channel_flipbits(struct frm *frame)
+{
+    uint8_t buf[FRMMAX + FECMAX];
+    int flips;
+
+    if (bitskip >= frm_nbytes() * 8)
+    {
+        bitskip -= frm_nbytes() * 8;
+        return 0;
+    }
+    frm_to_bytes(frame, buf);
+    flips = channel_flipbuf(buf, frm_nbytes());
+    frm_from_bytes(buf, frame);
+    return flips;
+}
+
+/* damaged frames pile up in undetframes and go through decode_batch() */
+/* UNDETBATCH at a time rather than through decode() one by one         */
+void undetected_flush(void)
+{
+    uint8_t rem[UNDETBATCH];
+    int i;
+
+    decode_batch(undetframes, nundetframes, rem);
+    for (i = 0; i < nundetframes; i++)
+        if (rem[i] == 0)
+            nundetected++;
+    nundetframes = 0;
+}
+
+/* count a damaged frame that, after any FEC repair, is of a valid type */
+/* and differs from the frame sent yet still passes the CRC             */
+void frame_undetected(struct frm *frame, struct frm *sent)
+{
+    uint8_t buf[FRMMAX + FECMAX], sentbuf[FRMMAX + FECMAX];
+    struct frm rcvd = *frame;
+
+    if (fecmode && fec_decode(&rcvd) < 0)
+        return;
+    if (rcvd.type != DATA && rcvd.type != ACK && rcvd.type != PACK)
+        return;
+    frm_to_bytes(&rcvd, buf);
+    frm_to_bytes(sent, sentbuf);
+    if (memcmp(buf, sentbuf, frm_hdrbytes()) == 0)
+        return;
+    if (nflows > 0) /* longer than decode_batch() takes: the CRC directly */
+    {
+        if (crc8(buf, frm_hdrbytes()) == 0)
+            nundetected++;
+        return;
+    }
+    undetframes[nundetframes++] = rcvd;
+    if (nundetframes == UNDETBATCH)
+        undetected_flush();
+}
+
+/************************ BYTE STREAM FRAMING *******************************/
+/* With framing set, tolayer1() does not pass the frame across as a struct: */
+/* it serializes it, puts it onto the byte stream between flags with any  */
+/* flag or escape inside stuffed (framing.c), and the channel damages     */
+/* those bytes.  The receiver runs them through its deframer, which hands */
+/* over whatever frames the flags delimit.  A frame of the wrong length,  */
+/* from a damaged flag or escape, is dropped here, and the next flag puts */
+/* the deframer back in step.                                             */
+
+/* damage the stuffed bytes of one frame; returns the bits flipped */
+int framing_corrupt(uint8_t *wire, int len)
+{
+    long bit;
+
+    if (corruptmodel == CORRUPT_BER)
+        return channel_flipbuf(wire, len);
+    if (channelrand() >= corruptprob)
+        return 0;
+    bit = channelrand() * len * 8; /* one bit anywhere, flags included */
+    if (bit >= len * 8)
+        bit = len * 8 - 1;
+    wire[bit / 8] ^= 0x80 >> (bit % 8);
+    nbitflips++;
+    return 1;
+}
+
+/* called by the deframer for every frame it finds */
+void framing_deliver(const uint8_t *buf, size_t len, void *arg)
+{
+    struct event *ev = arg;
+    struct frm frame;
+
+    if (len != (size_t)frm_nbytes())
+    {
+        nbadlength++;
+        if (TRACE > 0)
+            printf("          FROMLAYER1: %d byte frame discarded by framing\n",
+                   (int)len);
+        return;
+    }
+    memset(&frame, 0, sizeof(frame));
+    frm_from_bytes((uint8_t *)buf, &frame);
+    if (nflows > 0)
+        flow_input(ev->eventity, frame);
+    else if (ev->eventity == A)
+        A_input(frame);
+    else
+        B_input(frame);
+    if (ev->corrupted)
+        frame_undetected(&frame, ev->frmptr);
+}
+
+void framing_input(struct event *ev)
+{
+    deframe(&deframers[ev->eventity], ev->wire, ev->wirelen, framing_deliver, ev);
+    free(ev->wire);
+    free(ev->frmptr);
+}
+
+void framing_report(void)
+{
+    static const char *names[] = { "scalar", "SSE2", "AVX2" };
+    struct deframer *a = &deframers[A], *b = &deframers[B];
+
+    printf(" Framing: %ld bytes on the wire for %d frames, %ld of them escapes\n",
+           nwirebytes, ntolayer1, nescaped);
+    printf("   frames out %ld, wrong length %d, aborted %ld, overruns %ld\n",
+           a->frames + b->frames, nbadlength, a->aborts + b->aborts,
+           a->overruns + b->overruns);
+    printf("   bytes skipped resynchronizing %ld, %s flag scan\n",
+           a->discarded + b->discarded, names[framing_best()]);
+}
+
+/************************* LINK MODEL **************/
+/* Each sender has a transmitter that sends one frame at a time at      */
+/* bandwidth bytes per time unit, fed by a FIFO of at most qlimit       */
+/* frames (including the one being sent).  Frames are never reordered: */
+/* a frame that would overtake the previous one waits for it.          */
+
+struct link
+{
+    float txdone[LINKQMAX]; /* completion times of frames in the queue */
+    int head, count;        /* ring of frames queued or being sent */
+    float txlast;           /* completion time of the newest frame */
+    float busytotal;        /* transmitter time committed so far */
+    float busysampled;      /* busy time up to the previous sample */
+    float avgdepth;         /* RED's moving average of the depth */
+    int maxdepth;
+    long depthsum, depthsamples;
+    int nsent, ndropped;
+} links[2];
+
+void link_init(void)
+{
+    struct event *evptr;
+
+    if (qlimit > LINKQMAX)
+        qlimit = LINKQMAX;
+    memset(links, 0, sizeof(links));
+
+    if (statinterval > 0)
+    {
+        evptr = (struct event *)malloc(sizeof(struct event));
+        evptr->evtime = time + statinterval;
+        evptr->evtype = LINK_SAMPLE;
+        evptr->eventity = A;
+        insertevent(evptr);
+    }
+}
+
+/* forget frames whose transmission has completed; returns the depth */
+int link_depth(struct link *l)
+{
+    while (l->count > 0 && l->txdone[l->head] <= time)
+    {
+        l->head = (l->head + 1) % LINKQMAX;
+        l->count--;
+    }
+    return l->count;
+}
+
+/* queue a frame of nbytes at AorB's transmitter, unless the queue */
+/* discipline drops it; returns whether it was accepted */
+int link_enqueue(int AorB, int nbytes)
+{
+    struct link *l = &links[AorB];
+    int depth = link_depth(l);
+    float start, p;
+
+    l->avgdepth = (1 - redweight) * l->avgdepth + redweight * depth;
+    if (depth >= qlimit)
+    {
+        l->ndropped++;
+        return 0;
+    }
+    if (qdiscipline == QUEUE_RED && l->avgdepth >= redminth)
+    {
+        if (l->avgdepth >= redmaxth)
+            p = 1.0;
+        else
+            p = redmaxp * (l->avgdepth - redminth) / (redmaxth - redminth);
+        if (channelrand() < p)
+        {
+            l->ndropped++;
+            return 0;
+        }
+    }
+
+    start = l->txlast > time ? l->txlast : time;
+    l->txlast = start + nbytes / bandwidth;
+    l->busytotal += nbytes / bandwidth;
+    l->txdone[(l->head + l->count) % LINKQMAX] = l->txlast;
+    l->count++;
+    l->nsent++;
+
+    l->depthsum += l->count;
+    l->depthsamples++;
+    if (l->count > l->maxdepth)
+        l->maxdepth = l->count;
+    return 1;
+}
+
+/* arrival time at the far end of the frame just queued by AorB; */
+/* lastime is the arrival time of the frame in the medium before it */
+float link_arrival(int AorB, float lastime)
+{
+    float t = links[AorB].txlast + propdelay;
+
+    if (jitter > 0)
+        t += jitter * channelrand();
+    return t > lastime ? t : lastime;
+}
+
+/* busy time of the transmitter up to now */
+float link_busy(struct link *l)
+{
+    return l->busytotal - (l->txlast > time ? l->txlast - time : 0);
+}
+
+void link_sample(void)
+{
+    struct event *evptr;
+    float busy;
+    int i;
+
+    for (i = A; i <= B; i++)
+    {
+        busy = link_busy(&links[i]);
+        printf("          LINK %c->%c: time %f, utilization %f, queue %d\n",
+               i == A ? 'A' : 'B', i == A ? 'B' : 'A', time,
+               (busy - links[i].busysampled) / statinterval,
+               link_depth(&links[i]));
+        links[i].busysampled = busy;
+    }
+
+    if (evlist == NULL) /* nothing else will happen */
+        return;
+    evptr = (struct event *)malloc(sizeof(struct event));
+    evptr->evtime = time + statinterval;
+    evptr->evtype = LINK_SAMPLE;
+    evptr->eventity = A;
+    insertevent(evptr);
+}
+
+void sendq_report(void)
+{
+    struct Entity *e;
+    int i;
+
+    printf(" Packets held back from layer3: %d\n", nblocked);
+    for (i = A; i <= B; i++)
+    {
+        e = get_entity(i);
+        sendq_account(e);
+        printf(" Send queue %c: queued %d, refused %d, depth max %d, mean %f\n",
+               i == A ? 'A' : 'B', e->nqueued, e->nrefused, e->maxdepth,
+               time > 0 ? e->depthtime / time : 0);
+        printf("   wait: mean %f, max %f\n",
+               e->ndequeued ? e->waitsum / e->ndequeued : 0, e->waitmax);
+    }
+}
+
+void link_report(void)
+{
+    struct link *l;
+    float rtt = 2 * (propdelay + frm_nbytes() / bandwidth);
+    int i;
+
+    for (i = A; i <= B; i++)
+    {
+        l = &links[i];
+        printf(" Link %c->%c: sent %d, queue drops %d, utilization %f\n",
+               i == A ? 'A' : 'B', i == A ? 'B' : 'A', l->nsent, l->ndropped,
+               time > 0 ? link_busy(l) / time : 0);
+        printf("   queue depth: max %d, mean %f\n", l->maxdepth,
+               l->depthsamples ? (float)l->depthsum / l->depthsamples : 0);
+    }
+    printf(" Bandwidth-delay product: %f bytes (%f frames)\n",
+           bandwidth * rtt, bandwidth * rtt / frm_nbytes());
+}
+
+/************************** LAYER 3 PIPELINE ********************************/
+/* With pipeline set the simulator is one stage of a pipeline: it takes   */
+/* layer 3 packets from app.c's producer thread and hands deliveries to   */
+/* its consumer thread.                                                   */
+
+/* Bulk runs: the per-packet trace would dwarf the work being measured, */
+/* so it goes to /dev/null until the run is over.                       */
+void trace_off(void)
+{
+    int null;
+
+    fflush(stdout);
+    reportfd = dup(1);
+    if ((null = open("/dev/null", O_WRONLY)) >= 0)
+    {
+        dup2(null, 1);
+        close(null);
+    }
+}
+
+void trace_on(void)
+{
+    if (reportfd < 0)
+        return;
+    fflush(stdout);
+    dup2(reportfd, 1);
+    close(reportfd);
+    reportfd = -1;
+}
+
+void pipeline_start(void)
+{
+    if (!app_start())
+    {
+        printf("ERROR: cannot start the layer 3 application threads\n");
+        pipeline = 0;
+        return;
+    }
+    trace_off();
+}
+
+void pipeline_stop(void)
+{
+    app_stop(&pipestats);
+    trace_on();
+}
+
+void pipeline_report(void)
+{
+    struct appstats *st = &pipestats;
+
+    printf(" Pipeline: %ld packets to the consumer in %f s wall clock, %f packets/s\n",
+           st->delivered, st->wall, st->wall > 0 ? st->delivered / st->wall : 0);
+    printf("   in order %ld, duplicates %ld, missing %ld\n",
+           st->inorder, st->duplicates, st->missing);
+    printf("   simulated time of deliveries: %f to %f\n", st->simfirst, st->simlast);
+    printf("   simulator waited for the producer %ld times, for the consumer %ld times\n",
+           st->injectstalls, st->deliverstalls);
+}
+
+/***************************** FILE TRANSFER ********************************/
+/* With xferfile set, A's layer 3 sends that file 4 bytes a packet and B  */
+/* writes what it is handed, in order, into xferout, sized up front.  Both */
+/* files are mapped, so moving a packet in or out is a 4 byte copy.  The  */
+/* CRC-32s of the two are compared once the run is over.                  */
+
+void xfer_open(void)
+{
+    struct stat st;
+    int in, out;
+
+    if ((in = open(xferfile, O_RDONLY)) < 0 || fstat(in, &st) < 0)
+    {
+        printf("ERROR: cannot open %s\n", xferfile);
+        exit(1);
+    }
+    xfersize = st.st_size;
+    if ((out = open(xferout, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0 ||
+        ftruncate(out, xfersize) < 0)
+    {
+        printf("ERROR: cannot create %s\n", xferout);
+        exit(1);
+    }
+    if (xfersize > 0)
+    {
+        xfersrc = mmap(NULL, xfersize, PROT_READ, MAP_PRIVATE, in, 0);
+        xferdst = mmap(NULL, xfersize, PROT_READ | PROT_WRITE, MAP_SHARED, out, 0);
+        if (xfersrc == MAP_FAILED || xferdst == MAP_FAILED)
+        {
+            printf("ERROR: cannot map %s or %s\n", xferfile, xferout);
+            exit(1);
+        }
+        posix_madvise(xfersrc, xfersize, POSIX_MADV_SEQUENTIAL);
+        posix_madvise(xferdst, xfersize, POSIX_MADV_SEQUENTIAL);
+    }
+    close(in);
+    close(out);
+    nsimmax = (xfersize + 3) / 4;
+}
+
+void xfer_start(void)
+{
+    gettimeofday(&xferwall, NULL);
+    trace_off();
+}
+
+/* the next 4 bytes of the file, zero padded at its end */
+void xfer_take(char data[4])
+{
+    size_t n = xfersize - xferread < 4 ? xfersize - xferread : 4;
+
+    memset(data, 0, 4);
+    memcpy(data, xfersrc + xferread, n);
+}
+
+void xfer_write(char data[4])
+{
+    size_t n = xfersize - xferwritten < 4 ? xfersize - xferwritten : 4;
+
+    memcpy(xferdst + xferwritten, data, n);
+    xferwritten += n;
+}
+
+void xfer_finish(void)
+{
+    struct timeval now;
+    uint32_t crcin, crcout;
+    double wall, mb = xferwritten / 1e6;
+
+    trace_on();
+    gettimeofday(&now, NULL);
+    wall = (now.tv_sec - xferwall.tv_sec) + (now.tv_usec - xferwall.tv_usec) / 1e6;
+
+    crcin = crc32_update(0, xfersrc, xfersize);
+    crcout = crc32_update(0, xferdst, xfersize);
+    printf(" File transfer: %zu of %zu bytes written to %s\n", xferwritten,
+           xfersize, xferout);
+    printf("   CRC-32 sent %08x, received %08x: %s\n", (unsigned)crcin,
+           (unsigned)crcout,
+           crcin == crcout && xferwritten == xfersize ? "intact" : "DAMAGED");
+    printf("   goodput %g MB per unit of simulated time (%f units)\n",
+           time > 0 ? mb / time : 0, time);
+    printf("   goodput %f MB/s wall clock (%f s)\n", wall > 0 ? mb / wall : 0,
+           wall);
+
+    if (xfersize > 0)
+    {
+        msync(xferdst, xfersize, MS_SYNC);
+        munmap(xfersrc, xfersize);
+        munmap(xferdst, xfersize);
+    }
+}
+
+/************************* MULTIPLEXED FLOWS ********************************/
+/* With nflows set, A runs nflows stop-and-wait senders and B as many     */
+/* receivers, told apart by the connection ID in the frame header.  Every */
+/* flow always has data (layer 3 hands out packets until nsimmax) and     */
+/* frames of 1 + i % flowsizes plain frames on the wire, so a scheduler   */
+/* that counts frames instead of bytes favours the larger ones.           */
+/*                                                                        */
+/* Flows with a frame to send wait on the ready list; flow_schedule()     */
+/* takes them off it while A's transmit queue has room.  With SCHED_DRR   */
+/* the head of the list gets one plain frame of credit per visit and goes */
+/* to the back until its credit covers its frame.                         */
+/*                                                                        */
+/* The retransmission timers live in a hierarchical timing wheel rather   */
+/* than the event list: a single FLOW_TIMER event is kept for the next   */
+/* tick with work to do, and starting or stopping a timer is O(1) for any */
+/* number of flows.  Level l has WHEELSIZE slots of WHEELSIZE^l ticks; a  */
+/* timer sits at the lowest level that reaches its expiry and moves down  */
+/* a level each time the level below wraps around.                        */
+
+#define WHEELBITS 8
+#define WHEELSIZE (1 << WHEELBITS)
+#define WHEELLEVELS 4 /* timers up to 2^32 ticks ahead */
+
+struct wtimer
+{
+    struct wtimer *next, *prev; /* slot list; the slot heads are wtimers too */
+    unsigned long expires;      /* tick it goes off at */
+    int armed;
+    int owner;                  /* flow it belongs to */
+    void (*fire)(int owner);    /* called when it goes off */
+};
+
+struct
+{
+    struct wtimer slots[WHEELLEVELS][WHEELSIZE];
+    unsigned long now;          /* last tick run */
+    long count;                 /* timers armed */
+} wheel;
+
+struct flow
+{
+    /* sender, at A */
+    int outgoingSeq;
+    int waiting;                /* lastFrame is out and not yet ACKed */
+    int resend;                 /* the timer went off: lastFrame is due again */
+    struct frm lastFrame;
+    struct wtimer timer;
+    int deficit;                /* DRR credit in bytes */
+    int ready;                  /* on the ready list */
+    int next;                   /* next on the ready list, -1 at the end */
+    int nsent, ntimeouts;
+
+    /* station on the shared medium */
+    int backlog;                /* frames arrived and not yet sent */
+    struct wtimer mactimer;     /* its next try for the channel */
+    int collisions;             /* of the frame it is trying to send */
+    float macready;             /* when that frame was ready */
+
+    /* receiver, at B */
+    int incomingSeq;
+    int ndelivered;
+    long bytes;                 /* delivered while layer 3 still had data */
+};
+
+struct flow *flows;
+int readyhead, readytail;       /* ready list, -1 when empty */
+unsigned long wheelpending;     /* tick of the FLOW_TIMER event, 0 if none */
+int flowtxpending;              /* so is a FLOW_TX event */
+float flowend;                  /* when layer 3 ran out, 0 until then */
+
+void wheel_init(void)
+{
+    int l, i;
+
+    for (l = 0; l < WHEELLEVELS; l++)
+        for (i = 0; i < WHEELSIZE; i++)
+            wheel.slots[l][i].next = wheel.slots[l][i].prev = &wheel.slots[l][i];
+    wheel.now = 0;
+    wheel.count = 0;
+}
+
+void wheel_link(struct wtimer *t)
+{
+    unsigned long delta = t->expires - wheel.now;
+    struct wtimer *head;
+    int l = 0;
+
+    while (l < WHEELLEVELS - 1 && delta >> (WHEELBITS * (l + 1)) != 0)
+        l++;
+    head = &wheel.slots[l][(t->expires >> (WHEELBITS * l)) & (WHEELSIZE - 1)];
+    t->next = head->next;
+    t->prev = head;
+    head->next->prev = t;
+    head->next = t;
+}
+
+void wheel_unlink(struct wtimer *t)
+{
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+}
+
+/* arm t to go off at tick expires, in the future */
+void wheel_add(struct wtimer *t, unsigned long expires)
+{
+    unsigned long horizon = (1UL << (WHEELBITS * WHEELLEVELS)) - 1;
+
+    if (expires <= wheel.now)
+        expires = wheel.now + 1;
+    if (expires - wheel.now > horizon)
+        expires = wheel.now + horizon;
+    t->expires = expires;
+    t->armed = 1;
+    wheel.count++;
+    wheel_link(t);
+}
+
+void wheel_del(struct wtimer *t)
+{
+    if (!t->armed)
+        return;
+    wheel_unlink(t);
+    t->armed = 0;
+    wheel.count--;
+}
+
+/* move the timers of a slot at level l down to where they now belong */
+void wheel_cascade(int l, int slot)
+{
+    struct wtimer *head = &wheel.slots[l][slot], *t;
+
+    while ((t = head->next) != head)
+    {
+        wheel_unlink(t);
+        wheel_link(t);
+    }
+}
+
+/* run the wheel up to tick, firing every timer due on the way */
+void wheel_advance(unsigned long tick)
+{
+    struct wtimer *head, *t;
+    int l;
+
+    while (wheel.now < tick && wheel.count > 0)
+    {
+        wheel.now++;
+        for (l = 1; l < WHEELLEVELS &&
+                    (wheel.now & ((1UL << (WHEELBITS * l)) - 1)) == 0; l++)
+            wheel_cascade(l, (wheel.now >> (WHEELBITS * l)) & (WHEELSIZE - 1));
+
+        head = &wheel.slots[0][wheel.now & (WHEELSIZE - 1)];
+        while ((t = head->next) != head)
+        {
+            wheel_del(t);
+            t->fire(t->owner);
+        }
+    }
+    if (wheel.now < tick) /* nothing armed: skip the idle ticks */
+        wheel.now = tick;
+}
+
+/* the next tick anything can happen at: a timer due in this round of */
+/* level 0, or else the end of the round, where the levels above cascade */
+unsigned long wheel_next(void)
+{
+    struct wtimer *head;
+    unsigned long t;
+
+    for (t = wheel.now + 1; (t & (WHEELSIZE - 1)) != 0; t++)
+    {
+        head = &wheel.slots[0][t & (WHEELSIZE - 1)];
+        if (head->next != head)
+            return t;
+    }
+    return t;
+}
+
+/* keep a FLOW_TIMER event in the list for the next tick that matters */
+void wheel_schedule(void)
+{
+    struct event *evptr;
+    unsigned long next;
+
+    if (wheel.count == 0)
+        return;
+    next = wheel_next();
+    if (wheelpending != 0 && wheelpending <= next)
+        return;
+    evptr = (struct event *)malloc(sizeof(struct event));
+    evptr->evtime = next * wheeltick;
+    evptr->evtype = FLOW_TIMER;
+    evptr->eventity = A;
+    insertevent(evptr);
+    wheelpending = next;
+}
+
+/* bytes flow id's data frames take on the wire */
+int flow_bytes(int id)
+{
+    return frm_nbytes() * (1 + id % flowsizes);
+}
+
+void flow_ready(int id)
+{
+    struct flow *f = &flows[id];
+
+    if (f->ready)
+        return;
+    f->ready = 1;
+    f->next = -1;
+    if (readytail < 0)
+        readyhead = id;
+    else
+        flows[readytail].next = id;
+    readytail = id;
+}
+
+int flow_unready(void)
+{
+    int id = readyhead;
+
+    readyhead = flows[id].next;
+    if (readyhead < 0)
+        readytail = -1;
+    flows[id].ready = 0;
+    return id;
+}
+
+/* send flow id's next frame, or its last one again after a timeout */
+void flow_transmit(int id)
+{
+    struct flow *f = &flows[id];
+    struct frm frame;
+    int i;
+
+    if (!f->waiting)
+    {
+        memset(&frame, 0, sizeof(frame));
+        frame.type = DATA;
+        frame.seqnum = f->outgoingSeq;
+        frame.connid = id;
+        for (i = 0; i < 4; i++)
+            frame.payload[i] = 97 + nsim % 26;
+        frame.payload[3] = 0;
+        frame.checksum = encode(&frame);
+        if (fecmode)
+            fec_encode(&frame);
+        f->lastFrame = frame;
+        f->waiting = 1;
+        if (macmode)
+            f->backlog--;
+        nsim++;
+        if (nsim == nsimmax)
+            flowend = time;
+    }
+    if (TRACE > 1)
+        printf("          FLOW %d: %s frame %d\n", id,
+               f->resend ? "resending" : "sending", f->outgoingSeq);
+    f->resend = 0;
+    if (macmode)
+        mac_send(id); /* flow_sent() once it has the channel */
+    else
+        flow_sent(id, 1);
+}
+
+/* flow id's frame went out, or the shared medium gave up on it: */
+/* the timer runs from now either way                            */
+void flow_sent(int id, int onair)
+{
+    struct flow *f = &flows[id];
+
+    if (onair)
+    {
+        f->nsent++;
+        tolayer1(A, f->lastFrame);
+    }
+
+    if (wheel.count == 0) /* the wheel stood still while nothing was armed */
+        wheel.now = (unsigned long)(time / wheeltick);
+    wheel_add(&f->timer, (unsigned long)ceil((time + flowtimeout) / wheeltick));
+    wheel_schedule();
+}
+
+/* hand frames of ready flows to A's transmit queue while it has room */
+void flow_schedule(void)
+{
+    struct event *evptr;
+    struct flow *f;
+    int id;
+
+    while (readyhead >= 0 && (!linkmodel || link_depth(&links[A]) < qlimit))
+    {
+        id = readyhead;
+        f = &flows[id];
+        /* nothing left to send: */
+        if (!f->waiting && (nsim >= nsimmax || (macmode && f->backlog == 0)))
+        {
+            flow_unready();
+            continue;
+        }
+        if (flowsched == SCHED_DRR && f->deficit < flow_bytes(id))
+        {
+            f->deficit += frm_nbytes();
+            if (f->deficit < flow_bytes(id)) /* to the back of the round */
+            {
+                flow_unready();
+                flow_ready(id);
+                continue;
+            }
+        }
+        flow_unready();
+        f->deficit = 0; /* it has nothing more until this frame is ACKed */
+        flow_transmit(id);
+    }
+
+    /* come back when the frame at the head of the queue has gone out */
+    if (readyhead >= 0 && linkmodel && !flowtxpending)
+    {
+        evptr = (struct event *)malloc(sizeof(struct event));
+        evptr->evtime = links[A].txdone[links[A].head];
+        evptr->evtype = FLOW_TX;
+        evptr->eventity = A;
+        insertevent(evptr);
+        flowtxpending = 1;
+    }
+}
+
+void flow_tx(void)
+{
+    flowtxpending = 0;
+    flow_schedule();
+}
+
+void flow_tick(void)
+{
+    unsigned long tick = (unsigned long)(time / wheeltick + 0.5); /* on a tick */
+
+    if (tick == wheelpending) /* not one a sooner timer made redundant */
+        wheelpending = 0;
+    wheel_advance(tick);
+    if (macmode)
+        mac_resolve(); /* the last slot the wheel got to */
+    flow_schedule();
+    wheel_schedule();
+}
+
+void flow_timeout(int id)
+{
+    struct flow *f = &flows[id];
+
+    if (TRACE > 1)
+        printf("          FLOW %d: timeout\n", id);
+    f->ntimeouts++;
+    f->resend = 1;
+    flow_ready(id);
+}
+
+void flow_ack(int id, int ack)
+{
+    struct frm frame;
+
+    memset(&frame, 0, sizeof(frame));
+    frame.type = ACK;
+    frame.seqnum = flows[id].incomingSeq;
+    frame.acknum = ack;
+    frame.connid = id;
+    frame.checksum = encode(&frame);
+    if (fecmode)
+        fec_encode(&frame);
+    tolayer1(B, frame);
+}
+
+/* a frame of some flow arrived at AorB */
+void flow_input(int AorB, struct frm frame)
+{
+    struct flow *f;
+    int id;
+
+    if (fecmode)
+    {
+        int fixed = fec_decode(&frame);
+        if (fixed > 0)
+            nfecrepaired++;
+        else if (fixed < 0)
+            nfecfailed++;
+    }
+    id = frame.connid; /* as received, perhaps damaged */
+    if (decode(&frame) != 0)
+    {
+        if (AorB == B && id >= 0 && id < nflows) /* NACK, if the ID is plausible */
+            flow_ack(id, inc_seq(flows[id].incomingSeq));
+        return;
+    }
+    if (id < 0 || id >= nflows)
+        return;
+    f = &flows[id];
+
+    if (AorB == A && frame.type == ACK)
+    {
+        if (!f->waiting || frame.acknum != f->outgoingSeq)
+            return; /* a NACK or a stale ACK: the timer takes care of it */
+        wheel_del(&f->timer);
+        f->waiting = 0;
+        f->outgoingSeq = inc_seq(f->outgoingSeq);
+        flow_ready(id);
+        flow_schedule();
+    }
+    else if (AorB == B && frame.type == DATA)
+    {
+        if (frame.seqnum != f->incomingSeq)
+        {
+            flow_ack(id, inc_seq(f->incomingSeq));
+            return;
+        }
+        flow_ack(id, f->incomingSeq);
+        tolayer3(B, frame.payload);
+        f->incomingSeq = inc_seq(f->incomingSeq);
+        f->ndelivered++;
+        if (flowend == 0)
+            f->bytes += flow_bytes(id);
+    }
+}
+
+void flow_init(void)
+{
+    int i;
+
+    if (flowsizes < 1)
+        flowsizes = 1;
+    free(flows);
+    flows = calloc(nflows, sizeof(struct flow));
+    wheel_init();
+    wheelpending = flowtxpending = 0;
+    readyhead = readytail = -1;
+    flowend = 0;
+    for (i = 0; i < nflows; i++)
+    {
+        flows[i].timer.owner = i;
+        flows[i].timer.fire = flow_timeout;
+        flow_ready(i);
+    }
+    if (macmode)
+        mac_init();
+    flow_schedule();
+}
+
+/* Jain's index over the bytes each flow got while all had data: */
+/* 1 when they are equal, 1/nflows when one flow got everything  */
+double flow_fairness(void)
+{
+    double sum = 0, sumsq = 0;
+    int i;
+
+    for (i = 0; i < nflows; i++)
+    {
+        sum += flows[i].bytes;
+        sumsq += (double)flows[i].bytes * flows[i].bytes;
+    }
+    return sumsq > 0 ? sum * sum / (nflows * sumsq) : 0;
+}
+
+void flow_report(void)
+{
+    float span = flowend > 0 ? flowend : time;
+    long minbytes = LONG_MAX, maxbytes = 0, total = 0;
+    int sent = 0, timeouts = 0, i;
+
+    for (i = 0; i < nflows; i++)
+    {
+        struct flow *f = &flows[i];
+        if (nflows <= 16)
+            printf(" Flow %d: sent %d, timeouts %d, delivered %d, %f bytes/unit\n",
+                   i, f->nsent, f->ntimeouts, f->ndelivered,
+                   span > 0 ? f->bytes / span : 0);
+        sent += f->nsent;
+        timeouts += f->ntimeouts;
+        total += f->bytes;
+        if (f->bytes < minbytes)
+            minbytes = f->bytes;
+        if (f->bytes > maxbytes)
+            maxbytes = f->bytes;
+    }
+    printf(" Flows: %d, frames sent %d, timeouts %d\n", nflows, sent, timeouts);
+    if (span > 0)
+        printf(" Flow throughput up to %f: min %f, mean %f, max %f bytes/unit\n",
+               span, minbytes / span, total / span / nflows, maxbytes / span);
+    printf(" Jain's fairness index: %f\n", flow_fairness());
+}
+
+/**************************** SHARED MEDIUM *********************************/
+/* With macmode set, the flows are stations on one channel to B and every  */
+/* frame a flow sends has to win the channel first; B's ACKs come back on  */
+/* a channel of their own, as in ALOHAnet.  A tick of the wheel is the     */
+/* contention slot, the time it takes to hear that someone else is        */
+/* sending, and a frame holds the channel for macframe ticks.  New frames */
+/* arrive at random stations as one Poisson stream of macload frames per  */
+/* frame time, so the offered load can be set independently of the number */
+/* of stations.  The run is measured up to the last of nsimmax arrivals; */
+/* after it the stations stop contending, since beyond what a scheme can */
+/* carry (1/e for slotted ALOHA) their backlog would never drain.        */
+/*                                                                        */
+/* Stations waiting to send sit in the wheel, and only the ticks where    */
+/* one of them does anything are simulated, so the cost of a slot is the  */
+/* number of stations contending for it, whatever the number of stations: */
+/*   MAC_ALOHA   slots are a frame long; a frame goes in the next slot and */
+/*               after a collision in each later one with chance macretry */
+/*   MAC_CSMACD  a station waits for the channel to go quiet and then     */
+/*               sends; colliding stations stop after a slot and back off */
+/*               0..2^k-1 slots after the k-th collision, up to MACTRIES  */
+/*   MAC_TOKEN   a token goes round the stations one tick per hop and     */
+/*               lets the station holding it send one frame; stations    */
+/*               wanting it are a bitmap, so it jumps straight to the    */
+/*               next of them                                            */
+
+#define MACTRIES 16   /* CSMA/CD gives a frame up after as many collisions */
+#define MACBACKOFF 10 /* and stops doubling its backoff after as many */
+
+int *maccont;                   /* stations sending in slot macslot */
+int nmaccont;
+unsigned long macslot;
+unsigned long macbusy;          /* CSMA/CD: the channel is in use until */
+uint64_t *macwant;              /* token: stations with a frame waiting */
+int tokenpos;                   /* token: the station it reaches at */
+unsigned long tokentime;        /* this tick, moving on one a tick */
+struct wtimer tokentimer;       /* its next visit to a station that wants it */
+long macarrivals, macattempts, maccollisions, macgaveup;
+long macleft;                   /* frames still contending at macend */
+long macsent, macsentwin;       /* frames that got through, before macend */
+long macattemptswin;            /* tries before macend */
+double macdelay;                /* sum of their times from ready to sent */
+float macend;                   /* time of the last arrival, 0 until then */
+
+unsigned long mac_now(void)
+{
+    return (unsigned long)(time / wheeltick);
+}
+
+/* arm t for tick, catching the wheel up if it stood still while */
+/* nothing was armed                                             */
+void mac_arm(struct wtimer *t, unsigned long tick)
+{
+    if (wheel.count == 0)
+        wheel.now = mac_now();
+    wheel_add(t, tick);
+}
+
+void mac_arrival(void)
+{
+    struct event *evptr;
+    struct flow *f;
+    int id = channelrand() * nflows;
+
+    if (id >= nflows)
+        id = nflows - 1;
+    f = &flows[id];
+    f->backlog++;
+    if (++macarrivals < nsimmax)
+    {
+        evptr = (struct event *)malloc(sizeof(struct event));
+        evptr->evtime = time + expdraw(macframe * wheeltick / macload);
+        evptr->evtype = MAC_ARRIVAL;
+        evptr->eventity = A;
+        insertevent(evptr);
+    }
+    else
+        macend = time;
+    if (!f->waiting)
+    {
+        flow_ready(id);
+        flow_schedule();
+    }
+}
+
+/* first station at or after from, round the ring, with a frame waiting */
+int mac_wanting(int from)
+{
+    int nwords = (nflows + 63) / 64, w, i;
+    uint64_t bits;
+
+    for (i = 0; i <= nwords; i++)
+    {
+        w = (from / 64 + i) % nwords;
+        bits = macwant[w];
+        if (i == 0)
+            bits &= ~(uint64_t)0 << (from % 64);
+        if (bits)
+            return w * 64 + __builtin_ctzll(bits);
+    }
+    return -1;
+}
+
+/* point the token timer at the next station that wants the token */
+void mac_route(void)
+{
+    unsigned long from = mac_now() > tokentime ? mac_now() : tokentime;
+    int pos = (tokenpos + (from - tokentime) % nflows) % nflows;
+    int next = mac_wanting(pos);
+
+    wheel_del(&tokentimer);
+    if (next < 0)
+        return; /* it goes round unused */
+    tokentimer.owner = next;
+    mac_arm(&tokentimer, from + (next - pos + nflows) % nflows);
+}
+
+/* flow id has a frame for the channel */
+void mac_send(int id)
+{
+    struct flow *f = &flows[id];
+    unsigned long now = mac_now();
+
+    if (macend > 0)
+    {
+        macleft++;
+        return;
+    }
+    f->macready = time;
+    f->collisions = 0;
+    if (macmode == MAC_ALOHA)
+        mac_arm(&f->mactimer, (now / macframe + 1) * macframe);
+    else if (macmode == MAC_CSMACD)
+        mac_arm(&f->mactimer, macbusy > now + 1 ? macbusy : now + 1);
+    else
+    {
+        macwant[id / 64] |= (uint64_t)1 << (id % 64);
+        mac_route();
+    }
+    wheel_schedule();
+}
+
+void mac_success(int id, unsigned long slot)
+{
+    macsent++;
+    if (macend == 0)
+        macsentwin++;
+    macdelay += slot * wheeltick - flows[id].macready;
+    if (TRACE > 1)
+        printf("          MAC: station %d sends\n", id);
+    flow_sent(id, 1);
+}
+
+/* settle the slot the contenders sent in: one gets through, more collide */
+void mac_resolve(void)
+{
+    struct flow *f;
+    unsigned long wait;
+    int i, id, k;
+
+    if (nmaccont == 0)
+        return;
+    if (nmaccont == 1)
+    {
+        mac_success(maccont[0], macslot);
+        macbusy = macslot + macframe;
+        nmaccont = 0;
+        return;
+    }
+
+    maccollisions++;
+    if (TRACE > 1)
+        printf("          MAC: %d stations collide\n", nmaccont);
+    macbusy = macslot + 1; /* heard at once, and jammed for a slot */
+    for (i = 0; i < nmaccont; i++)
+    {
+        id = maccont[i];
+        f = &flows[id];
+        f->collisions++;
+        if (macmode == MAC_ALOHA)
+        {
+            mac_arm(&f->mactimer, macslot + macframe * (1 + geomskip(macretry)));
+            continue;
+        }
+        if (f->collisions >= MACTRIES)
+        {
+            macgaveup++; /* the flow's timer sends it again */
+            flow_sent(id, 0);
+            continue;
+        }
+        k = f->collisions < MACBACKOFF ? f->collisions : MACBACKOFF;
+        wait = channelrand() * (1UL << k);
+        if (wait >= 1UL << k) /* channelrand() can return 1 */
+            wait = (1UL << k) - 1;
+        mac_arm(&f->mactimer, macslot + 1 + wait);
+    }
+    nmaccont = 0;
+}
+
+/* a station's turn to send: its slot came, or it has the token */
+void mac_attempt(int id)
+{
+    unsigned long now = wheel.now;
+
+    if (macend > 0)
+    {
+        macleft++;
+        if (macmode == MAC_TOKEN)
+            macwant[id / 64] &= ~((uint64_t)1 << (id % 64));
+        return;
+    }
+    if (macmode == MAC_TOKEN)
+    {
+        macwant[id / 64] &= ~((uint64_t)1 << (id % 64));
+        macattempts++;
+        macattemptswin++;
+        mac_success(id, now);
+        tokenpos = (id + 1) % nflows; /* passed on once the frame is out */
+        tokentime = now + macframe + 1;
+        mac_route();
+        return;
+    }
+    if (macmode == MAC_CSMACD && now < macbusy) /* someone is sending */
+    {
+        wheel_add(&flows[id].mactimer, macbusy);
+        return;
+    }
+    if (nmaccont > 0 && macslot != now)
+        mac_resolve();
+    macslot = now;
+    maccont[nmaccont++] = id;
+    macattempts++;
+    macattemptswin++;
+}
+
+void mac_init(void)
+{
+    struct event *evptr;
+    int i;
+
+    if (macmode < MAC_ALOHA || macmode > MAC_TOKEN)
+    {
+        printf("ERROR: no MAC %d\n", macmode);
+        exit(1);
+    }
+    wheeltick = 1; /* a tick is a contention slot */
+    if (macframe < 1)
+        macframe = 1;
+    if (macretry <= 0 || macretry > 1)
+        macretry = 0.05;
+    free(maccont);
+    free(macwant);
+    maccont = malloc(nflows * sizeof(int));
+    macwant = calloc((nflows + 63) / 64, sizeof(uint64_t));
+    nmaccont = 0;
+    macslot = macbusy = 0;
+    tokenpos = 0;
+    tokentime = 0;
+    tokentimer.armed = 0;
+    tokentimer.fire = mac_attempt;
+    for (i = 0; i < nflows; i++)
+    {
+        flows[i].mactimer.owner = i;
+        flows[i].mactimer.fire = mac_attempt;
+    }
+    macarrivals = macattempts = maccollisions = macgaveup = macleft = 0;
+    macsent = macsentwin = macattemptswin = 0;
+    macdelay = 0;
+    macend = 0;
+
+    if (nsimmax > 0 && macload > 0)
+    {
+        evptr = (struct event *)malloc(sizeof(struct event));
+        evptr->evtime = expdraw(macframe * wheeltick / macload);
+        evptr->evtype = MAC_ARRIVAL;
+        evptr->eventity = A;
+        insertevent(evptr);
+    }
+}
+
+/* frames carried per frame time while new ones were still arriving: */
+/* the throughput S for the offered load macload                     */
+double mac_carried(void)
+{
+    return macend > 0 ? macsentwin * macframe * wheeltick / macend : 0;
+}
 
-    time = 0.0;              /* initialize time to 0.0 */
-    generate_next_arrival(); /* initialize event list */
+/* tries per frame time, retries included: the G of S = G e^-G */
+double mac_attempted(void)
+{
+    return macend > 0 ? macattemptswin * macframe * wheeltick / macend : 0;
 }
 
-/****************************************************************************/
-/* jimsrand(): return a float in range [0,1].  The routine below is used to */
-/* isolate all random number generation in one location.  We assume that the*/
-/* system-supplied rand() function return an int in therange [0,mmm]        */
-/****************************************************************************/
-float jimsrand(void)
+void mac_report(void)
 {
-    double mmm = RAND_MAX;
-    float x;                 /* individual students may need to change mmm */
-    x = rand() / mmm;        /* x should be uniform in [0,1] */
-    return (x);
+    float frames = macend / (macframe * wheeltick); /* frame times */
+
+    printf(" Shared medium: %s, %d stations\n", macnames[macmode], nflows);
+    if (frames > 0)
+    {
+        printf("   offered %f, carried %f frames per frame time up to %f\n",
+               macarrivals / frames, mac_carried(), macend);
+        printf("   tried %f times per frame time\n", mac_attempted());
+    }
+    printf("   attempts %ld, collisions %ld, given up %ld, sent %ld, left %ld\n",
+           macattempts, maccollisions, macgaveup, macsent, macleft);
+    if (macsent > 0)
+        printf("   access delay: mean %f\n", macdelay / macsent);
 }
 
-/********************* EVENT HANDLINE ROUTINES *******/
-/*  The next set of routines handle the event list   */
-/*****************************************************/
+/***************************** CHECKPOINTS **********************************/
+/* A checkpoint is the complete simulation: parameters, counters, channel   */
+/* and link state, both entities and every pending event with its frames.   */
+/* libc does not expose the state of rand(), so the seed and the number of  */
+/* draws taken are saved and the generator is fast-forwarded on restore.    */
+/* The same routines describe the layout for writing and reading, so the   */
+/* two can not drift apart.  The file is only read back by the same build.  */
 
-void generate_next_arrival(void)
+#define CKMAGIC 0x4b434c44 /* "DLCK" */
+#define CKVERSION 8
+
+FILE *ckfp;
+int ckwriting; /* writing (1) or reading (0) the checkpoint */
+int ckerror;   /* a read came up short */
+
+void ckio(void *p, size_t n)
 {
-    double x, log(), ceil();
-    struct event *evptr;
-    float ttime;
-    int tempint;
+    if (ckwriting)
+        fwrite(p, n, 1, ckfp);
+    else if (fread(p, n, 1, ckfp) != 1)
+        ckerror = 1;
+}
+#define CKIO(x) ckio(&(x), sizeof(x))
 
-    if (TRACE > 2)
-        printf("          GENERATE NEXT ARRIVAL: creating new arrival\n");
+void ckheader(void)
+{
+    int magic = CKMAGIC, version = CKVERSION;
 
-    x = lambda * jimsrand() * 2; /* x is uniform on [0,2*lambda] */
-    /* having mean of lambda        */
-    evptr = (struct event *)malloc(sizeof(struct event));
-    evptr->evtime = time + x;
-    evptr->evtype = FROM_LAYER3;
-    if (BIDIRECTIONAL && (jimsrand() > 0.5))
-        evptr->eventity = B;
-    else
-        evptr->eventity = A;
-    insertevent(evptr);
+    CKIO(magic);
+    CKIO(version);
+    if (magic != CKMAGIC || version != CKVERSION)
+        ckerror = 1;
 }
 
-void insertevent(struct event *p)
+/* everything init() would otherwise set from the chosen case */
+void ckparams(void)
 {
-    struct event *q, *qold;
+    CKIO(nsimmax); CKIO(lossprob); CKIO(corruptprob); CKIO(lambda);
+    CKIO(TRACE); CKIO(showcrcsteps); CKIO(piggybacking); CKIO(generator);
+    CKIO(seed);
+    CKIO(lossmodel); CKIO(corruptmodel); CKIO(ber);
+    CKIO(gegood2bad); CKIO(gebad2good); CKIO(gelossgood); CKIO(gelossbad);
+    CKIO(losstrace);
+    CKIO(linkmodel); CKIO(bandwidth); CKIO(propdelay); CKIO(jitter);
+    CKIO(qlimit); CKIO(qdiscipline);
+    CKIO(redminth); CKIO(redmaxth); CKIO(redmaxp); CKIO(redweight);
+    CKIO(statinterval);
+    CKIO(fecmode); CKIO(rsparity); CKIO(sendqdepth);
+    CKIO(fastretransmit); CKIO(fastholdoff); CKIO(fastmax);
+    CKIO(traffic); CKIO(sources);
+    CKIO(logmode); CKIO(logfile);
+}
 
-    if (TRACE > 2)
-    {
-        printf("            INSERTEVENT: time is %lf\n", time);
-        printf("            INSERTEVENT: future time will be %lf\n", p->evtime);
-    }
-    q = evlist;      /* q points to header of list in which p struct inserted */
-    if (q == NULL)   /* list is empty */
-    {
-        evlist = p;
-        p->next = NULL;
-        p->prev = NULL;
-    }
-    else
+/* everything that changes while the simulation runs */
+void ckstate(void)
+{
+    struct event *q, *last;
+    int nevents, hasorig, i;
+
+    CKIO(time); CKIO(nsim); CKIO(nrand);
+    CKIO(ntolayer1); CKIO(nlost); CKIO(ncorrupt);
+    CKIO(nbitflips); CKIO(nundetected); CKIO(nqdrop); CKIO(nblocked);
+    CKIO(heldpkt); CKIO(held);
+    CKIO(nfecrepaired); CKIO(nfecfailed); CKIO(nretransmit);
+    CKIO(nfastretransmit); CKIO(nfastsuppressed);
+    CKIO(nrecovered); CKIO(recoverytime);
+    CKIO(bitskip); CKIO(gebad); CKIO(gerun); CKIO(geskip);
+    CKIO(tracelen); CKIO(tracepos);
+    if (!ckwriting && !ckerror && tracelen > 0)
+        tracebuf = malloc(tracelen);
+    if (tracelen > 0)
+        ckio(tracebuf, tracelen);
+    CKIO(links);
+    CKIO(arrivallog.pos); CKIO(channellog.pos);
+    CKIO(ndelivered);
+    ckio(get_entity(A), sizeof(struct Entity));
+    ckio(get_entity(B), sizeof(struct Entity));
+
+    for (nevents = 0, q = evlist; q != NULL; q = q->next)
+        nevents++;
+    CKIO(nevents);
+    q = evlist;
+    last = NULL;
+    for (i = 0; i < nevents && !ckerror; i++)
     {
-        for (qold = q; q != NULL && p->evtime > q->evtime; q = q->next)
-            qold = q;
-        if (q == NULL)   /* end of list */
+        if (!ckwriting)  /* rebuild the list in the saved order */
         {
-            qold->next = p;
-            p->prev = qold;
-            p->next = NULL;
+            q = (struct event *)malloc(sizeof(struct event));
+            q->frmptr = NULL;
+            q->origptr = NULL;
+            q->wire = NULL;
+            q->prev = last;
+            q->next = NULL;
+            if (last == NULL)
+                evlist = q;
+            else
+                last->next = q;
         }
-        else if (q == evlist)     /* front of list */
+        CKIO(q->evtime); CKIO(q->evtype); CKIO(q->eventity);
+        CKIO(q->corrupted);
+        if (q->evtype == FROM_LAYER1)
         {
-            p->next = evlist;
-            p->prev = NULL;
-            p->next->prev = p;
-            evlist = p;
+            if (!ckwriting)
+                q->frmptr = (struct frm *)malloc(sizeof(struct frm));
+            ckio(q->frmptr, sizeof(struct frm));
         }
-        else     /* middle of list */
+        hasorig = q->origptr != NULL;
+        CKIO(hasorig);
+        if (hasorig)
         {
-            p->next = q;
-            p->prev = q->prev;
-            q->prev->next = p;
-            q->prev = p;
+            if (!ckwriting)
+                q->origptr = (struct frm *)malloc(sizeof(struct frm));
+            ckio(q->origptr, sizeof(struct frm));
         }
+        last = q;
+        q = q->next;
     }
 }
 
-void printevlist(void)
+/* write a checkpoint from a forked copy of the simulator, so the run */
+/* only pauses for the fork */
+void checkpoint_save(char *file)
 {
-    struct event *q;
-    int i;
-    printf("--------------\nEvent List Follows:\n");
-    for (q = evlist; q != NULL; q = q->next)
+    pid_t pid;
+
+    if (nflows > 0) /* the flows, their timers and the wheel are not covered */
     {
-        printf("Event time: %f, type: %d entity: %d\n", q->evtime, q->evtype,
-               q->eventity);
+        printf("Checkpoints do not cover multiplexed flows, none written\n");
+        return;
     }
-    printf("--------------\n");
+    if (xferfile[0] != '\0') /* nor are the mapped files */
+    {
+        printf("Checkpoints do not cover file transfers, none written\n");
+        return;
+    }
+    if (framing) /* nor the bytes on the stream and the deframers */
+    {
+        printf("Checkpoints do not cover framing, none written\n");
+        return;
+    }
+    if (pipeline) /* nor the application queues and their sources */
+    {
+        printf("Checkpoints do not cover the layer 3 pipeline, none written\n");
+        return;
+    }
+
+    fflush(stdout);
+    if ((pid = fork()) > 0)
+    {
+        if (TRACE > 0)
+            printf("          CHECKPOINT: saving to %s at time %f\n", file, time);
+        return;
+    }
+
+    ckfp = fopen(file, "wb");
+    if (ckfp == NULL)
+    {
+        printf("ERROR: cannot write checkpoint %s\n", file);
+    }
+    else
+    {
+        ckwriting = 1;
+        ckheader();
+        ckparams();
+        ckstate();
+        fclose(ckfp);
+    }
+    if (pid == 0)
+        _exit(0);
+    /* fork failed: the checkpoint was written in-line */
 }
 
-/********************** Student-callable ROUTINES ***********************/
+void ckopen(char *file)
+{
+    ckfp = fopen(file, "rb");
+    if (ckfp == NULL)
+    {
+        printf("ERROR: cannot read checkpoint %s\n", file);
+        exit(1);
+    }
+    ckwriting = 0;
+    ckerror = 0;
+    ckheader();
+}
 
-/* called by students routine to cancel a previously-started timer */
-void stoptimer(int AorB /* A or B is trying to stop timer */)
+void ckclose(char *file)
 {
-    struct event *q, *qold;
+    fclose(ckfp);
+    if (ckerror)
+    {
+        printf("ERROR: %s is not a usable checkpoint\n", file);
+        exit(1);
+    }
+}
 
-    if (TRACE > 2)
-        printf("          STOP TIMER: stopping timer at %f\n", time);
-    /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
-    for (q = evlist; q != NULL; q = q->next)
-        if ((q->evtype == TIMER_INTERRUPT && q->eventity == AorB))
+/* read the parameters only, for init() to report */
+void checkpoint_params(char *file)
+{
+    ckopen(file);
+    ckparams();
+    ckclose(file);
+}
+
+void checkpoint_restore(char *file)
+{
+    unsigned long n;
+
+    while (evlist != NULL) /* anything A_init() or B_init() scheduled */
+    {
+        struct event *q = evlist;
+        evlist = q->next;
+        free(q);
+    }
+
+    ckopen(file);
+    ckparams();
+    if (logmode != LOG_OFF) /* a restored recording only holds the rest */
+        log_open();
+    ckstate();
+    ckclose(file);
+    if (logmode == LOG_RECORD)
+        arrivallog.pos = channellog.pos = 0;
+
+    srand(seed);
+    for (n = 0; n < nrand; n++)
+        rand();
+    if (fecmode)
+        fec_init();
+    for (n = A; n <= B; n++)
+        if (traffic && sources[n].type == SRC_TRACE)
+            traffic_load(n);
+    if (TRACE > 0)
+        printf("          CHECKPOINT: restored %s at time %f\n", file, time);
+}
+
+/************************** PARAMETER SWEEP *********************************/
+/* A sweep runs every point of a grid of parameters several times, each  */
+/* replication with its own seed, and writes the mean of every metric    */
+/* and its 95% confidence interval as one CSV row per point.  The grid   */
+/* file has one directive per line, # starts a comment:                  */
+/*     case 4                  preset the points start from               */
+/*     replications 10         runs per point, seeds 9999, 10000, ...     */
+/*     threads 0               pool workers, 0 for one per core           */
+/*     lossprob 0 0.1 0.2      a parameter and the values it takes        */
+/* The simulator keeps its state in globals, so two replications cannot  */
+/* share a process: a worker forks a child for each one, which runs with */
+/* its output sent to /dev/null and pipes its metrics back.              */
+
+#define SWEEPMAXAXES 8
+#define SWEEPMAXVALUES 32
+
+struct sweepparam
+{
+    const char *name;
+    float *f;          /* the parameter if it is a float */
+    int *i;            /* or if it is an int */
+};
+
+struct sweepparam sweepparams[] = {
+    { "nsimmax",      NULL,         &nsimmax      },
+    { "lossprob",     &lossprob,    NULL          },
+    { "corruptprob",  &corruptprob, NULL          },
+    { "lambda",       &lambda,      NULL          },
+    { "piggybacking", NULL,         &piggybacking },
+    { "ber",          &ber,         NULL          },
+    { "fecmode",      NULL,         &fecmode      },
+    { "rsparity",     NULL,         &rsparity     },
+    { "sendqdepth",   NULL,         &sendqdepth   },
+    { "bandwidth",    &bandwidth,   NULL          },
+    { "propdelay",    &propdelay,   NULL          },
+    { "qlimit",       NULL,         &qlimit       },
+    { "fastretransmit", NULL,       &fastretransmit },
+    { "fastholdoff",  &fastholdoff, NULL          },
+    { "fastmax",      NULL,         &fastmax      },
+    { "nflows",       NULL,         &nflows       },
+    { "flowsizes",    NULL,         &flowsizes    },
+    { "flowsched",    NULL,         &flowsched    },
+    { "flowtimeout",  &flowtimeout, NULL          },
+    { "macmode",      NULL,         &macmode      },
+    { "macframe",     NULL,         &macframe     },
+    { "macload",      &macload,     NULL          },
+    { "macretry",     &macretry,    NULL          },
+    { "rateA",        &sources[A].rate,    NULL   },
+    { "rateB",        &sources[B].rate,    NULL   },
+    { "onmeanA",      &sources[A].onmean,  NULL   },
+    { "onmeanB",      &sources[B].onmean,  NULL   },
+    { "offmeanA",     &sources[A].offmean, NULL   },
+    { "offmeanB",     &sources[B].offmean, NULL   },
+};
+#define NSWEEPPARAMS (int)(sizeof(sweepparams) / sizeof(sweepparams[0]))
+
+struct sweepaxis
+{
+    struct sweepparam *param;
+    int nvalues;
+    float values[SWEEPMAXVALUES];
+};
+
+#define NSWEEPMETRICS 15
+const char *sweepmetrics[NSWEEPMETRICS] = {
+    "time", "delivered", "throughput", "frames", "efficiency",
+    "retransmits", "lost", "corrupted", "undetected", "blocked",
+    "fastretransmits", "recovery", "fairness", "carried", "attempted",
+};
+
+struct sweepaxis sweepaxes[SWEEPMAXAXES];
+int sweepnaxes;
+int sweeppoints;       /* product of the number of values on each axis */
+int sweepreps;         /* replications of each point */
+int sweepthreads;      /* 0 for one worker per core */
+double *sweepresults;  /* NSWEEPMETRICS per replication, NAN if it failed */
+
+/* two-sided 95% quantiles of Student's t for 1 to 30 degrees of freedom */
+static const double sweept95[30] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+};
+
+/* whether the simulator can run with a parameter at value v; values */
+/* outside a parameter's domain are refused when the grid is read     */
+int sweep_valid(struct sweepparam *param, float v)
+{
+    if (param->i != NULL && (v != floorf(v) || v < INT_MIN || v > INT_MAX))
+        return 0; /* ints take whole numbers */
+    if (param->i == &nsimmax)
+        return v >= 0;
+    if (param->f == &lossprob || param->f == &corruptprob || param->f == &ber)
+        return v >= 0 && v <= 1;
+    if (param->f == &lambda || param->f == &propdelay ||
+        param->f == &fastholdoff || param->f == &macload)
+        return v >= 0;
+    if (param->f == &bandwidth || param->f == &flowtimeout)
+        return v > 0;
+    if (param->f == &sources[A].rate || param->f == &sources[B].rate ||
+        param->f == &sources[A].onmean || param->f == &sources[B].onmean ||
+        param->f == &sources[A].offmean || param->f == &sources[B].offmean)
+        return v > 0;
+    if (param->f == &macretry)
+        return v > 0 && v <= 1;
+    if (param->i == &piggybacking || param->i == &fastretransmit)
+        return v == 0 || v == 1;
+    if (param->i == &sendqdepth)
+        return v >= 0 && v <= SENDQMAX;
+    if (param->i == &qlimit || param->i == &flowsizes ||
+        param->i == &macframe)
+        return v >= 1;
+    if (param->i == &fastmax)
+        return v >= 0;
+    if (param->i == &flowsched)
+        return v == SCHED_FIFO || v == SCHED_DRR;
+    if (param->i == &fecmode)
+        return v == FEC_NONE || v == FEC_SECDED || v == FEC_RS;
+    if (param->i == &rsparity) /* RS check bytes must fit in FECMAX */
+        return v == 2 || v == 4;
+    if (param->i == &nflows)
+        return v >= 0 && v <= MAXFLOWS;
+    if (param->i == &macmode)
+        return v == MAC_NONE || v == MAC_ALOHA || v == MAC_CSMACD ||
+               v == MAC_TOKEN;
+    return 1;
+}
+
+/* read the grid, returning the case its points start from */
+int sweep_load(char *file)
+{
+    FILE *gf;
+    char line[512], name[64], *p, *end;
+    int basecase = 0, off, i;
+    struct sweepaxis *ax;
+    float v;
+
+    if ((gf = fopen(file, "r")) == NULL)
+    {
+        printf("ERROR: cannot open sweep grid %s\n", file);
+        exit(1);
+    }
+    sweepreps = 1;
+    sweepthreads = 0;
+    sweepnaxes = 0;
+    while (fgets(line, sizeof(line), gf) != NULL)
+    {
+        if (sscanf(line, "%63s%n", name, &off) != 1 || name[0] == '#')
+            continue;
+        p = line + off;
+        if (strcmp(name, "case") == 0)
+            basecase = (int)strtol(p, NULL, 10);
+        else if (strcmp(name, "replications") == 0)
+            sweepreps = (int)strtol(p, NULL, 10);
+        else if (strcmp(name, "threads") == 0)
+            sweepthreads = (int)strtol(p, NULL, 10);
+        else
         {
-            /* remove this event */
-            if (q->next == NULL && q->prev == NULL)
-                evlist = NULL;          /* remove first and only event on list */
-            else if (q->next == NULL) /* end of list - there is one in front */
-                q->prev->next = NULL;
-            else if (q == evlist)   /* front of list - there must be event after */
+            for (i = 0; i < NSWEEPPARAMS; i++)
+                if (strcmp(sweepparams[i].name, name) == 0)
+                    break;
+            if (i == NSWEEPPARAMS)
             {
-                q->next->prev = NULL;
-                evlist = q->next;
+                printf("ERROR: unknown sweep parameter %s\n", name);
+                exit(1);
             }
-            else     /* middle of list */
+            if (sweepnaxes == SWEEPMAXAXES)
             {
-                q->next->prev = q->prev;
-                q->prev->next = q->next;
+                printf("ERROR: more than %d sweep parameters\n", SWEEPMAXAXES);
+                exit(1);
+            }
+            ax = &sweepaxes[sweepnaxes++];
+            ax->param = &sweepparams[i];
+            ax->nvalues = 0;
+            while (ax->nvalues < SWEEPMAXVALUES)
+            {
+                v = strtof(p, &end);
+                if (end == p)
+                    break;
+                if (!sweep_valid(ax->param, v))
+                {
+                    printf("ERROR: sweep parameter %s cannot be %g\n", name, v);
+                    exit(1);
+                }
+                ax->values[ax->nvalues++] = v;
+                p = end;
+            }
+            if (ax->nvalues == 0)
+            {
+                printf("ERROR: sweep parameter %s has no values\n", name);
+                exit(1);
             }
-            free(q);
-            return;
         }
-    printf("Warning: unable to cancel your timer. It wasn't running.\n");
+    }
+    fclose(gf);
+
+    if (sweepreps < 1)
+        sweepreps = 1;
+    sweeppoints = 1;
+    for (i = 0; i < sweepnaxes; i++)
+        sweeppoints *= sweepaxes[i].nvalues;
+    return basecase;
 }
 
-void starttimer(int AorB /* A or B is trying to start timer */, float increment)
+/* value of axis k at a point, the last axis varying fastest */
+float sweep_value(int point, int k)
 {
-    struct event *q;
-    struct event *evptr;
+    int i;
 
-    if (TRACE > 2)
-        printf("          START TIMER: starting timer at %f\n", time);
-    /* be nice: check to see if timer is already started, if so, then  warn */
-    /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
-    for (q = evlist; q != NULL; q = q->next)
-        if ((q->evtype == TIMER_INTERRUPT && q->eventity == AorB))
+    for (i = sweepnaxes - 1; i > k; i--)
+        point /= sweepaxes[i].nvalues;
+    return sweepaxes[k].values[point % sweepaxes[k].nvalues];
+}
+
+void sweep_apply(int point)
+{
+    struct sweepparam *param;
+    int k;
+
+    for (k = 0; k < sweepnaxes; k++)
+    {
+        param = sweepaxes[k].param;
+        if (param->f != NULL)
+            *param->f = sweep_value(point, k);
+        else
+            *param->i = (int)sweep_value(point, k);
+    }
+    if (sendqdepth > SENDQMAX)
+        sendqdepth = SENDQMAX;
+    if (fecmode == FEC_RS && rsparity != 2 && rsparity != 4)
+        rsparity = 2; /* the base case did not use Reed-Solomon */
+}
+
+void sweep_metrics(double *m)
+{
+    int delivered = ndelivered[A] + ndelivered[B];
+
+    m[0] = time;
+    m[1] = delivered;
+    m[2] = time > 0 ? delivered / time : 0;
+    m[3] = ntolayer1;
+    m[4] = ntolayer1 > 0 ? (double)delivered / ntolayer1 : 0;
+    m[5] = nretransmit;
+    m[6] = nlost;
+    m[7] = ncorrupt;
+    m[8] = nundetected;
+    m[9] = nblocked;
+    m[10] = nfastretransmit;
+    m[11] = nrecovered > 0 ? recoverytime / nrecovered : NAN;
+    m[12] = nflows > 0 ? flow_fairness() : NAN;
+    m[13] = nflows > 0 && macmode ? mac_carried() : NAN;
+    m[14] = nflows > 0 && macmode ? mac_attempted() : NAN;
+}
+
+/* pool job: one replication in a child process */
+void sweep_job(int job, void *arg)
+{
+    double *m = sweepresults + (long)job * NSWEEPMETRICS;
+    size_t size = NSWEEPMETRICS * sizeof(double), got = 0;
+    ssize_t n;
+    pid_t pid;
+    int fd[2], i, piped;
+
+    (void)arg;
+    piped = pipe(fd) == 0;
+    if ((pid = piped ? fork() : -1) == 0)
+    {
+        close(fd[0]);
+        freopen("/dev/null", "w", stdout);
+        sweep_apply(job / sweepreps);
+        seed += job % sweepreps;
+        TRACE = 0;
+        init_state();
+        simulate();
+        sweep_metrics(m);
+        n = write(fd[1], m, size);
+        _exit(n == (ssize_t)size ? 0 : 1);
+    }
+    if (piped)
+        close(fd[1]);
+    while (pid > 0 && got < size &&
+           (n = read(fd[0], (char *)m + got, size - got)) > 0)
+        got += n;
+    if (piped)
+        close(fd[0]);
+    if (pid > 0)
+        waitpid(pid, NULL, 0);
+    if (got < size) /* no pipe, fork failed or the child died */
+        for (i = 0; i < NSWEEPMETRICS; i++)
+            m[i] = NAN;
+}
+
+/* mean and 95% confidence half-width of metric i over a point's runs */
+int sweep_merge(int point, int i, double *mean, double *half)
+{
+    double *m, sum = 0, sumsq = 0, var;
+    int r, n = 0;
+
+    for (r = 0; r < sweepreps; r++)
+    {
+        m = sweepresults + ((long)point * sweepreps + r) * NSWEEPMETRICS;
+        if (isnan(m[i]))
+            continue;
+        sum += m[i];
+        sumsq += m[i] * m[i];
+        n++;
+    }
+    *mean = n > 0 ? sum / n : NAN;
+    *half = 0;
+    if (n > 1)
+    {
+        var = (sumsq - sum * sum / n) / (n - 1);
+        *half = (n - 1 <= 30 ? sweept95[n - 2] : 1.96) *
+                sqrt(var > 0 ? var / n : 0);
+    }
+    return n;
+}
+
+void sweep_run(void)
+{
+    struct timeval t0, t1;
+    FILE *csv;
+    int njobs = sweeppoints * sweepreps, nfailed = 0, p, i, k, n;
+    double mean, half, wall;
+
+    printf("Sweep: %d points x %d replications, %d threads\n", sweeppoints,
+           sweepreps, sweepthreads > 0 ? sweepthreads : pool_ncpus());
+    fflush(stdout); /* or every child writes the buffer out again */
+
+    sweepresults = malloc((size_t)njobs * NSWEEPMETRICS * sizeof(double));
+    gettimeofday(&t0, NULL);
+    pool_run(njobs, sweepthreads, sweep_job, NULL);
+    gettimeofday(&t1, NULL);
+    wall = (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6;
+
+    if ((csv = fopen(sweepcsv, "w")) == NULL)
+    {
+        printf("ERROR: cannot write sweep results to %s\n", sweepcsv);
+        free(sweepresults);
+        return;
+    }
+    for (k = 0; k < sweepnaxes; k++)
+        fprintf(csv, "%s,", sweepaxes[k].param->name);
+    fprintf(csv, "replications");
+    for (i = 0; i < NSWEEPMETRICS; i++)
+        fprintf(csv, ",%s,%s_ci95", sweepmetrics[i], sweepmetrics[i]);
+    fprintf(csv, "\n");
+
+    for (p = 0; p < sweeppoints; p++)
+    {
+        for (k = 0; k < sweepnaxes; k++)
+            fprintf(csv, "%g,", sweep_value(p, k));
+        n = sweep_merge(p, 0, &mean, &half);
+        nfailed += sweepreps - n;
+        fprintf(csv, "%d", n);
+        for (i = 0; i < NSWEEPMETRICS; i++)
         {
-            printf("Warning: attempt to start a timer that is already started\n");
-            return;
+            sweep_merge(p, i, &mean, &half);
+            fprintf(csv, ",%g,%g", mean, half);
         }
+        fprintf(csv, "\n");
 
-    /* create future event for when timer goes off */
-    evptr = (struct event *)malloc(sizeof(struct event));
-    evptr->evtime = time + increment;
-    evptr->evtype = TIMER_INTERRUPT;
-    evptr->eventity = AorB;
-    insertevent(evptr);
+        printf(" ");
+        for (k = 0; k < sweepnaxes; k++)
+            printf("%s %g, ", sweepaxes[k].param->name, sweep_value(p, k));
+        sweep_merge(p, 2, &mean, &half);
+        printf("throughput %f +- %f", mean, half);
+        sweep_merge(p, 4, &mean, &half);
+        printf(", efficiency %f +- %f\n", mean, half);
+    }
+    fclose(csv);
+
+    printf(" Sweep of %d runs took %f s wall clock, %d failed\n", njobs, wall,
+           nfailed);
+    printf(" Results: %s\n", sweepcsv);
+    free(sweepresults);
 }
 
 /************************** TOLAYER1 ***************/
@@ -945,17 +4485,40 @@ void tolayer1(int AorB, struct frm frame)
 {
     struct frm *myfrmptr;
     struct event *evptr, *q;
+    uint8_t bytes[FRMMAX + FECMAX], wire[STUFFMAX(FRMMAX + FECMAX)];
     float lastime, x;
-    int i;
+    int i, n, wirelen = 0;
+    PROF_BEGIN(tolayer1);
 
     ntolayer1++;
 
+    /* put the frame onto the byte stream: */
+    if (framing)
+    {
+        n = frm_to_bytes(&frame, bytes);
+        wirelen = framing_stuff(bytes, n, wire);
+        nwirebytes += wirelen;
+        nescaped += wirelen - n - 2;
+    }
+
+    /* wait for the transmitter, or be dropped by a full queue: */
+    if (linkmodel &&
+        !link_enqueue(AorB, framing ? wirelen : frm_wirebytes(&frame)))
+    {
+        nqdrop++;
+        if (TRACE > 0)
+            printf("          TOLAYER1: frame dropped at transmit queue\n");
+        PROF_END(tolayer1, PROF_TOLAYER1);
+        return;
+    }
+
     /* simulate losses: */
-    if (jimsrand() < lossprob)
+    if (channel_loses())
     {
         nlost++;
         if (TRACE > 0)
             printf("          TOLAYER1: frame being lost\n");
+        PROF_END(tolayer1, PROF_TOLAYER1);
         return;
     }
 
@@ -968,6 +4531,8 @@ void tolayer1(int AorB, struct frm frame)
     myfrmptr->checksum = frame.checksum;
     for (i = 0; i < 4; i++)
         myfrmptr->payload[i] = frame.payload[i];
+    memcpy(myfrmptr->parity, frame.parity, FECMAX);
+    myfrmptr->connid = frame.connid;
     if (TRACE > 2)
     {
         printf("          TOLAYER1: type : %d seq: %d, ack %d, check: %d ",
@@ -991,13 +4556,47 @@ void tolayer1(int AorB, struct frm frame)
     for (q = evlist; q != NULL; q = q->next)
         if ((q->evtype == FROM_LAYER1 && q->eventity == evptr->eventity))
             lastime = q->evtime;
-    evptr->evtime = lastime + 1 + 9 * jimsrand();
+    if (linkmodel)
+        evptr->evtime = link_arrival(AorB, lastime);
+    else
+        evptr->evtime = lastime + 1 + 9 * channelrand();
 
     /* simulate corruption: */
-    if (jimsrand() < corruptprob)
+    evptr->corrupted = 0;
+    evptr->origptr = NULL;
+    evptr->wire = NULL;
+    if (framing) /* of the bytes; myfrmptr stays the frame as sent */
+    {
+        if (framing_corrupt(wire, wirelen))
+        {
+            ncorrupt++;
+            evptr->corrupted = 1;
+            if (TRACE > 0)
+                printf("          TOLAYER1: frame being corrupted\n");
+        }
+        evptr->wire = (uint8_t *)malloc(wirelen);
+        memcpy(evptr->wire, wire, wirelen);
+        evptr->wirelen = wirelen;
+    }
+    else if (corruptmodel == CORRUPT_BER)
+    {
+        if (channel_flipbits(myfrmptr))
+        {
+            ncorrupt++;
+            evptr->corrupted = 1;
+            evptr->origptr = (struct frm *)malloc(sizeof(struct frm));
+            *evptr->origptr = frame;
+            if (TRACE > 0)
+                printf("          TOLAYER1: frame being corrupted\n");
+        }
+    }
+    else if (channelrand() < corruptprob)
     {
         ncorrupt++;
-        if ((x = jimsrand()) < .75)
+        evptr->corrupted = 1;
+        evptr->origptr = (struct frm *)malloc(sizeof(struct frm));
+        *evptr->origptr = frame;
+        if ((x = channelrand()) < .75)
             myfrmptr->payload[0] = 'Z'; /* corrupt payload */
         else if (x < .875)
             myfrmptr->seqnum = 999999;
@@ -1010,15 +4609,21 @@ void tolayer1(int AorB, struct frm frame)
     if (TRACE > 2)
         printf("          TOLAYER1: scheduling arrival on other side\n");
     insertevent(evptr);
+    PROF_END(tolayer1, PROF_TOLAYER1);
 }
 
-void tolayer3(int AorB, char datasent[20])
+void tolayer3(int AorB, char datasent[4])
 {
     int i;
+    ndelivered[AorB]++;
+    if (pipeline)
+        app_deliver(AorB, time, datasent);
+    if (xferfile[0] != '\0' && AorB == B)
+        xfer_write(datasent);
     if (TRACE > 2)
     {
         printf("          TOLAYER3: data received: ");
-        for (i = 0; i < 20; i++)
+        for (i = 0; i < 4; i++)
             printf("%c", datasent[i]);
         printf("\n");
     }
@@ -0,0 +1,95 @@
+#define _POSIX_C_SOURCE 200112L
+#include <stdlib.h>
+#include <string.h>
+
+#include "ring.h"
+
+/*
+ * head and tail count records ever pushed and popped; they only grow, so
+ * head - tail is the fill level even after they wrap.  The release store
+ * of head publishes the record written before it, and the release store
+ * of tail hands the slot back; the acquire loads on the other side pair
+ * with them.  The two sides live on separate cache lines so that neither
+ * invalidates the other's line on every record.
+ */
+
+#define CACHELINE 64
+
+struct ring
+{
+    /* written by the producer */
+    size_t head __attribute__((aligned(CACHELINE)));
+    size_t tailcache;           /* tail as the producer last saw it */
+
+    /* written by the consumer */
+    size_t tail __attribute__((aligned(CACHELINE)));
+    size_t headcache;           /* head as the consumer last saw it */
+
+    /* read only */
+    size_t nslots __attribute__((aligned(CACHELINE)));
+    size_t mask;
+    size_t size;
+    unsigned char *slots;
+};
+
+struct ring *ring_create(size_t nslots, size_t size)
+{
+    struct ring *r;
+    void *p;
+    size_t n = 1;
+
+    while (n < nslots)
+        n <<= 1;
+    if (posix_memalign(&p, CACHELINE, sizeof(struct ring)) != 0)
+        return NULL;
+    r = p;
+    memset(r, 0, sizeof(*r));
+    if (posix_memalign(&p, CACHELINE, n * size) != 0)
+    {
+        free(r);
+        return NULL;
+    }
+    r->slots = p;
+    r->nslots = n;
+    r->mask = n - 1;
+    r->size = size;
+    return r;
+}
+
+void ring_free(struct ring *r)
+{
+    if (r == NULL)
+        return;
+    free(r->slots);
+    free(r);
+}
+
+int ring_push(struct ring *r, const void *rec)
+{
+    size_t head = r->head;
+
+    if (head - r->tailcache == r->nslots)
+    {
+        r->tailcache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        if (head - r->tailcache == r->nslots)
+            return 0;
+    }
+    memcpy(r->slots + (head & r->mask) * r->size, rec, r->size);
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+int ring_pop(struct ring *r, void *rec)
+{
+    size_t tail = r->tail;
+
+    if (tail == r->headcache)
+    {
+        r->headcache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        if (tail == r->headcache)
+            return 0;
+    }
+    memcpy(rec, r->slots + (tail & r->mask) * r->size, r->size);
+    __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+    return 1;
+}